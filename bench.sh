@@ -0,0 +1,69 @@
+#!/usr/bin/env bash
+# uso: ./bench.sh [escala ...]   (padrão: $BENCH_ESCALAS ou "1 4 16")
+# Saída: bench<TAB>escala<TAB>operacao<TAB>n<TAB>segundos
+set -eu
+
+RAIZ=$(cd "$(dirname "$0")" && pwd)
+TRABALHO="$RAIZ/trabalho"
+GERADOR="$RAIZ/gerador"
+DIR="$RAIZ/bench"
+N_BUSCAS=${BENCH_BUSCAS:-2000}
+N_MUTACOES=${BENCH_MUTACOES:-500}
+GERADOR_OPCOES=${BENCH_GERADOR:-}
+ESCALAS=${*:-${BENCH_ESCALAS:-1 4 16}}
+TIMEFORMAT=%R
+
+medir(){
+    local op=$1 n=$2; shift 2
+    local t
+    t=$( { time "$@" >/dev/null 2>&1; } 2>&1 ) || { echo "bench: falha em $op (escala $escala)" >&2; exit 1; }
+    printf 'bench\t%s\t%s\t%s\t%s\n' "$escala" "$op" "$n" "$t"
+}
+
+printf 'bench\tescala\toperacao\tn\tsegundos\n'
+# Diretório vazio: só os deltas existem, sem joias.dat nem pedidos.dat.
+escala=0
+d="$DIR/vazio"
+rm -rf "$d"; mkdir -p "$d"; cd "$d"
+medir vazio-add-produto 1 "$TRABALHO" add-produto jewelry.ring gold "ring vazio" 9.99
+medir vazio-add-pedido 1 "$TRABALHO" add-pedido 1 1
+medir vazio-pedido 1 "$TRABALHO" pedido 1
+medir vazio-mais-caras 1 "$TRABALHO" mais-caras 10
+medir vazio-faixa-preco 1 "$TRABALHO" faixa-preco 1 100
+cd "$RAIZ"
+for escala in $ESCALAS; do
+    d="$DIR/escala.$escala"
+    rm -rf "$d"; mkdir -p "$d"; cd "$d"
+    # shellcheck disable=SC2086
+    "$GERADOR" -e "$escala" $GERADOR_OPCOES dados.csv 2>/dev/null
+    printf 'bench\t%s\tlinhas-csv\t%s\t-\n' "$escala" "$(wc -l < dados.csv)"
+
+    medir import 1 "$TRABALHO" import dados.csv
+
+    passo=$(( $(wc -l < dados.csv) / N_BUSCAS + 1 ))
+    awk -F, -v p="$passo" 'NR%p==1{print "produto\t"$3}' dados.csv > buscas-produto.txt
+    awk -F, -v p="$passo" 'NR%p==1{print "pedido\t"$2}' dados.csv > buscas-pedido.txt
+    nome=$(awk -F, 'NR==1{c=$6; sub(/^jewelry\./,"",c); n=c; for(i=11;i<=13;i++) if($i!="") n=n" "$i; print n}' dados.csv)
+    categoria=$(awk -F, 'NR==1{c=$6; sub(/^jewelry\./,"",c); print c}' dados.csv)
+    : > vazio.txt
+    for i in $(seq "$N_MUTACOES"); do printf 'add-produto\tjewelry.ring\tgold\tring bench %s\t%s.99\n' "$i" "$i"; done > add-produto.txt
+    for i in $(seq "$N_MUTACOES"); do printf 'produto,inserir,jewelry.ring,gold,ring lote %s,%s.99\n' "$i" "$i"; done > lote-produto.txt
+    ids=$(awk -F, 'NR<=3{printf "%s%s", (NR>1?",":""), $3}' dados.csv)
+    for i in $(seq "$N_MUTACOES"); do printf 'add-pedido\t3\t%s\n' "$ids"; done > add-pedido.txt
+    for i in $(seq "$N_MUTACOES"); do printf 'pedido,inserir,%s\n' "${ids//,/ }"; done > lote-pedido.txt
+
+    medir abertura 1 "$TRABALHO" script vazio.txt
+    medir busca-produto "$(wc -l < buscas-produto.txt)" "$TRABALHO" script buscas-produto.txt
+    medir busca-pedido "$(wc -l < buscas-pedido.txt)" "$TRABALHO" script buscas-pedido.txt
+    medir mais-caras 1 "$TRABALHO" mais-caras 10
+    medir vendas-nome 1 "$TRABALHO" vendas-nome "$nome"
+    medir vendas-categoria 1 "$TRABALHO" vendas-categoria "$categoria"
+    medir add-produto 1 "$TRABALHO" add-produto jewelry.ring gold "ring bench" 9.99
+    medir add-pedido 1 "$TRABALHO" add-pedido 3 "$ids"
+    medir add-produto-unitario "$N_MUTACOES" "$TRABALHO" script add-produto.txt
+    medir add-produto-lote "$N_MUTACOES" "$TRABALHO" lote lote-produto.txt
+    medir add-pedido-unitario "$N_MUTACOES" "$TRABALHO" script add-pedido.txt
+    medir add-pedido-lote "$N_MUTACOES" "$TRABALHO" lote lote-pedido.txt
+    medir compactar 1 "$TRABALHO" compactar
+    cd "$RAIZ"
+done
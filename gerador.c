@@ -0,0 +1,114 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#define BASE_PRODUTO   1515966223000000000LL
+#define BASE_PEDIDO    1924719209000000000LL
+#define BASE_CATEGORIA 1806829201890738000LL
+#define BASE_USUARIO   1515915625000000000LL
+#define BASE_DATA      1543622400
+#define PRODUTOS_ESCALA 10000
+#define PEDIDOS_ESCALA  75000
+
+static const char* categorias[]={
+    "jewelry.earring","jewelry.ring","jewelry.pendant","jewelry.necklace","jewelry.bracelet",
+    "jewelry.brooch","jewelry.souvenir","jewelry.stud","jewelry.chain","jewelry.cufflinks",
+    "jewelry.anklet","jewelry.tiara"
+};
+static const char* cores[]={"red","white","yellow","black","green","blue","pink","orange"};
+static const char* metais[]={"gold","silver","platinum","palladium"};
+static const char* pedras[]={"diamond","sapphire","ruby","emerald","pearl","topaz","garnet","amethyst","fianit"};
+#define N_ITENS(v) (sizeof(v)/sizeof *(v))
+
+typedef struct { uint8_t cat, cor, metal, pedra; double preco; } ProdutoGer;
+
+static uint64_t semente=42;
+static uint64_t aleatorio(void){
+    uint64_t z=(semente+=0x9e3779b97f4a7c15ULL);
+    z=(z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+    z=(z^(z>>27))*0x94d049bb133111ebULL;
+    return z^(z>>31);
+}
+static double uniforme(void){ return (aleatorio()>>11)*(1.0/9007199254740992.0); }
+static uint64_t ate(uint64_t n){ return aleatorio()%n; }
+
+static void die(const char* m){ perror(m); exit(1); }
+
+static int ler_num(const char* s, double* v){
+    char* e; errno=0;
+    *v=strtod(s,&e);
+    return s[0] && !*e && !errno && *v>=0;
+}
+
+static void uso(void){
+    fprintf(stderr,"uso: gerador [-e escala] [-p produtos] [-o pedidos] [-i itens] [-z assimetria] [-s semente] [saida.csv|-]\n");
+    fprintf(stderr,"  escala 1 = %d produtos e %d pedidos; itens = máximo de itens por pedido (padrão 3);\n", PRODUTOS_ESCALA, PEDIDOS_ESCALA);
+    fprintf(stderr,"  assimetria = expoente Zipf das categorias (0 = uniforme, padrão 1)\n");
+    exit(2);
+}
+
+int main(int argc, char** argv){
+    double escala=1, produtos=-1, pedidos=-1, itens=3, zipf=1, sem=42;
+    const char* saida="-";
+    for(int i=1;i<argc;i++){
+        const char* a=argv[i];
+        double* alvo=NULL;
+        if(strcmp(a,"-e")==0) alvo=&escala;
+        else if(strcmp(a,"-p")==0) alvo=&produtos;
+        else if(strcmp(a,"-o")==0) alvo=&pedidos;
+        else if(strcmp(a,"-i")==0) alvo=&itens;
+        else if(strcmp(a,"-z")==0) alvo=&zipf;
+        else if(strcmp(a,"-s")==0) alvo=&sem;
+        else if(a[0]=='-' && a[1]) uso();
+        else{ saida=a; continue; }
+        if(i+1>=argc || !ler_num(argv[++i],alvo)) uso();
+    }
+    if(produtos<0) produtos=PRODUTOS_ESCALA*escala;
+    if(pedidos<0) pedidos=PEDIDOS_ESCALA*escala;
+    if(produtos<1 || itens<1) uso();
+    semente=(uint64_t)sem;
+
+    size_t np=(size_t)produtos, no=(size_t)pedidos, maxi=(size_t)itens, nc=N_ITENS(categorias);
+    double acum[N_ITENS(categorias)], total=0;
+    for(size_t c=0;c<nc;c++){ total+=1.0/pow((double)(c+1),zipf); acum[c]=total; }
+
+    ProdutoGer* pr=malloc(np*sizeof *pr); if(!pr) die("malloc produtos");
+    for(size_t p=0;p<np;p++){
+        double u=uniforme()*total; size_t c=0;
+        while(c+1<nc && acum[c]<u) c++;
+        pr[p].cat=(uint8_t)c;
+        pr[p].cor=(uint8_t)ate(N_ITENS(cores));
+        pr[p].metal=(uint8_t)ate(N_ITENS(metais));
+        pr[p].pedra=(uint8_t)(ate(10)<3? N_ITENS(pedras) : ate(N_ITENS(pedras)));
+        pr[p].preco=(double)(50+ate(200000))/100.0*(1+c%4);
+    }
+
+    FILE* out=strcmp(saida,"-")==0? stdout : fopen(saida,"w");
+    if(!out) die(saida);
+    size_t linhas=0;
+    for(size_t o=0;o<no;o++){
+        time_t t=(time_t)(BASE_DATA+o*37);
+        struct tm tm; gmtime_r(&t,&tm);
+        char data[32]; strftime(data,sizeof data,"%Y-%m-%d %H:%M:%S UTC",&tm);
+        long long usuario=BASE_USUARIO+(long long)ate(np*4+1);
+        size_t k=1+ate(maxi);
+        for(size_t j=0;j<k;j++){
+            size_t p=ate(np);
+            const ProdutoGer* g=&pr[p];
+            fprintf(out,"%s,%lld,%lld,1,%lld,%s,0,%.2f,%lld,,%s,%s,%s\n", data,
+                    BASE_PEDIDO+(long long)o, BASE_PRODUTO+(long long)p, BASE_CATEGORIA+(long long)g->cat,
+                    categorias[g->cat], g->preco, usuario, cores[g->cor], metais[g->metal],
+                    g->pedra<N_ITENS(pedras)? pedras[g->pedra] : "");
+            linhas++;
+        }
+    }
+    if(out!=stdout && fclose(out)!=0) die(saida);
+    fprintf(stderr,"gerador: %zu produtos, %zu pedidos, %zu linhas.\n", np, no, linhas);
+    free(pr);
+    return 0;
+}
@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,17 +6,114 @@
 #include <errno.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stddef.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
 
 #define PATH_JOIAS        "joias.dat"
 #define PATH_JOIAS_IDX    "joias.idx"
 #define PATH_PEDIDOS      "pedidos.dat"
 #define PATH_PEDIDOS_IDX  "pedidos.idx"
+#define PATH_JOIAS_DELTA   "joias.delta"
+#define PATH_PEDIDOS_DELTA "pedidos.delta"
+#define PATH_JOIAS_META    "joias.meta"
+#define PATH_PEDIDOS_META  "pedidos.meta"
+#define PATH_JOIAS_NOME_IDX "joias_nome.idx"
+#define PATH_JOIAS_CAT_IDX  "joias_cat.idx"
+#define PATH_VENDAS_AGG    "vendas.agg"
+#define PATH_JOIAS_ZONA    "joias.zona"
+#define PATH_JOIAS_CAT_DIC   "joias_cat.dic"
+#define PATH_JOIAS_MARCA_DIC "joias_marca.dic"
+#define PATH_MANIFESTO     "geracao.man"
+#define PATH_GER_LOCK      "geracao.lock"
+#define PATH_ESCRITOR_LOCK "escritor.lock"
 
 #define CAT_MAX   64
 #define MARCA_MAX 64
 #define NOME_MAX  128
 #define JOIAS_INDEX_STEP 256
 #define MAX_ITENS_PEDIDO 50
+#define PEDIDOS_MAGIC "PEDVAR01"
+#define PEDIDOS_IDX_MAGIC "PEDESP01"
+#define PEDIDOS_IDX_PASSO_MAX 1024
+#define PEDVAR_CAB (sizeof(int64_t)+sizeof(int32_t))
+#define JOIAS_MAGIC "PRODCOD1"
+#define JOIAS_PAG_MAGIC "PRODPAG1"
+#define JOIAS_CMP_MAGIC "PRODCMP1"
+#define JOIAS_CMP_CAB 16
+#define JOIAS_CMP_REG_MAX 160
+#define PAGINA 4096
+#define JOIAS_PAGINAS_MAX 64
+#define DIC_MAGIC "DICION01"
+#define DIC_VALOR CAT_MAX
+#define DIC_MAX 65535
+#define JOIAS_DIC_CHEIO (-1)
+#define META_MAGIC "TABMETA1"
+#define META_VERSAO 3
+#define META_BORDA (64u*1024u)
+#define FNV_BASE 0xcbf29ce484222325ULL
+#define SECIDX_MAGIC "SECIDX01"
+#define SEC_LISTA_MAX 20
+#define VENDAS_MAGIC "VENDAG02"
+#define VENDAS_LOTE 65536
+#define VENDAS_DIFS_MAX 5
+#define ZONA_MAGIC "ZONAPR01"
+#define TOPK_MAX 100
+#define CLI_ARGS_MAX 8
+#define GER_MAGIC "GERACAO1"
+#define GER_PREFIXO "ger."
+#define GER_DIR 32
+#define GER_CAMINHO 96
+#define GER_INVALIDA UINT64_MAX
+#define GER_TENTATIVAS 100
+#ifndef POOL_BYTES
+#define POOL_BYTES (16u*1024u*1024u)
+#endif
+#ifndef USAR_MMAP
+#define USAR_MMAP 1
+#endif
+#ifndef DELTA_LIMITE
+#define DELTA_LIMITE 1024
+#endif
+#ifndef IMPORT_THREADS
+#define IMPORT_THREADS 0
+#endif
+#define IMPORT_THREADS_MAX 64
+#ifndef IMPORT_MEM_BUDGET
+#define IMPORT_MEM_BUDGET (1024u*1024u*1024u)
+#endif
+#define IMPORT_MAX_RUNS 64
+#define IMPORT_EXEMPLOS 5
+#define IMPORT_PARTE_MIN (1u<<20)
+#define IMPORT_AMOSTRA (1u<<20)
+#define IMPORT_BLOCO (16u<<20)
+#ifndef SCAN_THREADS
+#define SCAN_THREADS 0
+#endif
+#define SCAN_THREADS_MAX 64
+#define SCAN_REGISTROS_MIN 4096
+#define PEDIDOS_IDX_PAGINA 256
+#ifndef PEDIDOS_IDX_PASSO
+#define PEDIDOS_IDX_PASSO 16
+#endif
+#ifndef JOIAS_PAGINAS_BLOCO
+#define JOIAS_PAGINAS_BLOCO 2
+#endif
+#ifndef INDICE_MEM
+#define INDICE_MEM 0
+#endif
+#define INTERP_PASSOS 8
+#define BENCH_VARREDURAS 20
+#define BENCH_BUSCAS_DISCO 100000
+#define POOL_NHASH 1024
 
 typedef struct {
     int64_t id_produto;
@@ -25,12 +123,53 @@ typedef struct {
     double preco;
 } Produto;
 
+typedef struct {
+    int64_t id_produto;
+    uint16_t cod_categoria;
+    uint16_t cod_marca;
+    char nome[NOME_MAX];
+    double preco;
+} ProdutoCod;
+
 typedef struct {
     int64_t id_pedido;
     int32_t n_itens;
     int64_t ids_produtos[MAX_ITENS_PEDIDO];
 } Pedido;
 
+typedef struct {
+    int64_t id_pedido;
+    int32_t n_itens;
+    int64_t* ids_produtos;
+    size_t cap;
+} PedidoVar;
+
+enum { PED_FMT_FIXO=0, PED_FMT_VAR=1 };
+enum { JOIAS_FMT_FIXO=0, JOIAS_FMT_COD=1, JOIAS_FMT_PAG=2, JOIAS_FMT_CMP=3 };
+
+typedef struct { int fmt; uint32_t paginas; size_t tam, passo, tam_bloco; uint64_t ini; } LayoutJoias;
+enum { DIC_CAT=0, DIC_MARCA=1 };
+
+typedef struct {
+    char (*v)[DIC_VALOR];
+    size_t n, cap;
+    uint32_t* tab; size_t cap_tab;
+} Dicionario;
+enum { TAB_JOIAS=0, TAB_PEDIDOS=1 };
+
+typedef struct {
+    char magic[8];
+    uint32_t versao;
+    uint32_t formato;
+    uint64_t n_registros;
+    int64_t min_chave;
+    int64_t max_chave;
+    uint64_t tam_bytes;
+    int64_t mtime_ns;
+    uint64_t checksum;
+    uint64_t checksum_bordas;
+} TabelaMeta;
+
 typedef struct {
     int64_t id_base;
     uint64_t offset;
@@ -41,7 +180,190 @@ typedef struct {
     uint64_t offset;
 } PedidosIdxEntry;
 
+typedef struct {
+    char magic[8];
+    uint64_t passo;
+} PedidosIdxCab;
+
+typedef struct Quadro {
+    int arq;
+    uint64_t bloco;
+    unsigned char* dados;
+    size_t len;
+    struct Quadro *ant, *prox;
+    struct Quadro *hprox;
+} Quadro;
+
+typedef struct {
+    Quadro* hash[POOL_NHASH];
+    Quadro *mru, *lru;
+    size_t bytes, cap_bytes, nquadros;
+    unsigned long long hits, misses, diretos;
+} BufPool;
+
+typedef struct {
+    unsigned char* base;
+    size_t len;
+} Mapa;
+
+enum { DELTA_INS=1, DELTA_DEL=2 };
+
+typedef struct {
+    int32_t op;
+    uint16_t cod_categoria;
+    Produto p;
+} DeltaProd;
+
+typedef struct {
+    int32_t op;
+    PedidoVar p;
+} DeltaPed;
+
+typedef struct {
+    DeltaProd* v;
+    size_t n, cap, nlog;
+    uint64_t tam;
+    FILE* log;
+} DeltaJoias;
+
+typedef struct {
+    DeltaPed* v;
+    size_t n, cap, nlog;
+    uint64_t tam;
+    FILE* log;
+} DeltaPedidos;
+
+enum { SEC_NOME=0, SEC_CAT=1 };
+enum { DER_META_JOIAS=1, DER_META_PEDIDOS=2, DER_SEC=4, DER_ZONA=8, DER_VENDAS=16 };
+enum { USO_JOIAS=1, USO_PEDIDOS=2 };
+
+typedef struct { char magic[8]; uint64_t checksum; uint64_t n_chaves; uint64_t n_ids; } SecCab;
+typedef struct { char chave[NOME_MAX]; uint64_t ini; uint64_t n; } SecDirEntry;
+typedef struct { SecDirEntry* dir; int64_t* ids; size_t n_chaves, n_ids; } SecIdx;
+typedef struct { char chave[NOME_MAX]; int64_t id; } SecPar;
+typedef struct { uint32_t cod; int64_t id; } SecCod;
+
+typedef struct { int64_t id; double preco, preco_min, preco_max; int texto; } ConflitoProd;
+
+typedef struct {
+    size_t repetidos, conflitos;
+    ConflitoProd ex[IMPORT_EXEMPLOS]; size_t nex;
+} DupProd;
+
+typedef struct {
+    FILE** v; size_t n, cap;
+} ListaRuns;
+
+typedef struct {
+    FILE** runs; size_t nruns; size_t tam;
+    int (*cmp)(const void*, const void*);
+    unsigned char* recs;
+    size_t* heap; size_t nh;
+} MergeRuns;
+
+typedef struct {
+    SecPar* nomes; size_t n_nomes, cap_nomes, limite;
+    ListaRuns runs, runs_cods;
+    Dicionario cats;
+    SecCod* cods; size_t n_cods, cap_cods;
+} SecColetor;
+typedef struct {
+    FILE* f; FILE* ids; SecIdx* mem;
+    size_t cap_dir, cap_ids;
+    SecCab cab; SecDirEntry e;
+    char path[GER_CAMINHO], tmp[GER_CAMINHO+32];
+} SecSaida;
+
+typedef struct { char magic[8]; uint64_t checksum; uint64_t n_blocos; } ZonaCab;
+typedef struct { double min, max; } ZonaPreco;
+typedef struct { ZonaPreco* v; size_t n, cap; } Zonas;
+
+typedef struct { char magic[8]; uint64_t checksum; uint64_t n; } VendasCab;
+typedef struct { int64_t id_produto; int64_t unidades; } VendaProd;
+typedef struct { VendaProd* v; size_t n; VendaProd* pend; size_t npend; } Vendas;
+
+typedef struct { char magic[8]; uint64_t geracao; } GerCab;
+
+enum { INDICE_BINARIA=0, INDICE_EYTZINGER=1, INDICE_INTERPOLACAO=2 };
+
+typedef struct { int64_t* chaves; uint64_t* offsets; int64_t* eyt; size_t* rank; size_t n; int modo; } IndiceMem;
+
+typedef struct {
+    FILE* joias;
+    FILE* pedidos;
+    FILE* pedidos_idx;
+    JoiasIdxEntry* jidx;
+    size_t n_jidx;
+    size_t n_joias, n_pedidos;
+    size_t n_pidx, pidx_ini, passo_pidx;
+    BufPool pool;
+    int usar_mmap;
+    Mapa m_joias, m_joias_idx, m_pedidos, m_pedidos_idx;
+    int busca_indice;
+    IndiceMem ij, ip;
+    int fmt_pedidos;
+    LayoutJoias lj;
+    Dicionario dic[2];
+    TabelaMeta meta_joias, meta_pedidos;
+    int derivados, carregados;
+    SecIdx sec[2];
+    Zonas zonas;
+    DeltaJoias dj;
+    DeltaPedidos dp;
+    Vendas vendas;
+    uint64_t ger;
+    int fd_ger, fd_escritor, escritor_n;
+    pid_t compactador;
+    int indisponivel;
+    char erro[160];
+} Store;
+
+typedef struct {
+    FILE* f;
+    Mapa* m;
+    const LayoutJoias* l;
+    size_t pos, n;
+    unsigned char* buf;
+    size_t buf_n, buf_i;
+    uint64_t off;
+    ProdutoCod dec;
+} Cursor;
+
+typedef struct {
+    FILE* f;
+    Mapa* m;
+    int fmt;
+    size_t pos;
+    PedidoVar ped;
+} CursorPed;
+
+typedef struct {
+    Cursor c;
+    const DeltaJoias* d;
+    const Dicionario* dic;
+    size_t di;
+    const Produto* b;
+    Produto dec;
+    int avancar;
+} IterProd;
+
+typedef struct {
+    CursorPed c;
+    const DeltaPedidos* d;
+    size_t di;
+    const PedidoVar* b;
+    int avancar;
+} IterPed;
+
+enum { ARQ_JOIAS=0, ARQ_PEDIDOS_IDX=1 };
+#define PEDIDOS_IDX_PAGINA_BYTES ((size_t)PEDIDOS_IDX_PAGINA*sizeof(PedidosIdxEntry))
+
 static void die(const char* m){ perror(m); exit(1); }
+static char ger_dir[GER_DIR];
+static const char* ger_arq(char* buf, const char* nome){
+    snprintf(buf,GER_CAMINHO,"%s%s",ger_dir,nome);
+    return buf;
+}
 static size_t fsize(FILE* f){
     long p=ftell(f); if(p<0) die("ftell");
     if(fseek(f,0,SEEK_END)!=0) die("fseek end");
@@ -66,7 +388,7 @@ static int parse_csv_line(const char* line, char** out, int max, char* buf, size
             if(q){
                 if(c=='"'){
                     if(i<(int)L && line[i]=='"'){ if(w+1>=bufsz){ return -1; } buf[w++]='"'; i++; }
-                    else break;
+                    else q=0;
                 }else{
                     if(w+1>=bufsz){ return -1; } buf[w++]=c;
                 }
@@ -92,13 +414,31 @@ static int try_f64(const char* s, double* out){
     if(!s||!*s){ return 0; } char*e=0; errno=0; double v=strtod(s,&e);
     if(errno||e==s){ return 0; } *out=v; return 1;
 }
+static int64_t config_env(const char* nome, int64_t padrao, int64_t minimo){
+    const char* s=getenv(nome);
+    int64_t v;
+    if(!s || !*s) return padrao;
+    if(!try_i64(s,&v) || v<minimo){
+        fprintf(stderr,"%s inválido: \"%s\" (usando %lld).\n", nome, s, (long long)padrao);
+        return padrao;
+    }
+    return v;
+}
 static void safe_copy(char* dst, size_t cap, const char* src){
     if(!src) src="";
     size_t n=strlen(src); if(n>=cap) n=cap-1;
     memcpy(dst, src, n); dst[n]='\0';
 }
 
-typedef struct { int64_t id_produto; char categoria[CAT_MAX]; char marca[MARCA_MAX]; char nome[NOME_MAX]; double preco; } ProdutoTmp;
+static uint64_t hash_id(int64_t id){
+    uint64_t x=(uint64_t)id;
+    x^=x>>33; x*=0xff51afd7ed558ccdULL;
+    x^=x>>33; x*=0xc4ceb9fe1a85ec53ULL;
+    x^=x>>33;
+    return x;
+}
+
+typedef struct { int64_t id_produto; char categoria[CAT_MAX]; char marca[MARCA_MAX]; char nome[NOME_MAX]; double preco, preco_min, preco_max; int32_t conflito; } ProdutoTmp;
 typedef struct { int64_t id_pedido, id_produto; int32_t quantidade; } LinhaTmp;
 
 static int cmp_produto_id(const void* a, const void* b){
@@ -116,6 +456,466 @@ static int cmp_linha_by_pedido_then_prod(const void* a, const void* b){
     return 0;
 }
 
+typedef struct { uint64_t chave; uint64_t idx; } ChaveIdx;
+
+static uint64_t chave_radix(int64_t k){ return (uint64_t)k ^ (1ULL<<63); }
+
+static void radix_ordenar(ChaveIdx* v, ChaveIdx* tmp, size_t n){
+    size_t cont[8][256];
+    memset(cont,0,sizeof cont);
+    for(size_t i=0;i<n;i++)
+        for(int b=0;b<8;b++) cont[b][(v[i].chave>>(8*b))&255]++;
+    ChaveIdx* de=v; ChaveIdx* para=tmp;
+    for(int b=0;b<8;b++){
+        if(n==0 || cont[b][(v[0].chave>>(8*b))&255]==n) continue;
+        size_t soma=0;
+        for(int d=0;d<256;d++){ size_t c=cont[b][d]; cont[b][d]=soma; soma+=c; }
+        for(size_t i=0;i<n;i++) para[cont[b][(de[i].chave>>(8*b))&255]++]=de[i];
+        ChaveIdx* t=de; de=para; para=t;
+    }
+    if(de!=v) memcpy(v,de,n*sizeof *v);
+}
+static ChaveIdx* ordenar_produtos(const ProdutoTmp* v, size_t n){
+    ChaveIdx* ord=malloc((n? n:1)*sizeof *ord); ChaveIdx* tmp=malloc((n? n:1)*sizeof *tmp);
+    if(!ord || !tmp) die("malloc radix");
+    for(size_t i=0;i<n;i++){ ord[i].chave=chave_radix(v[i].id_produto); ord[i].idx=i; }
+    radix_ordenar(ord,tmp,n);
+    free(tmp);
+    return ord;
+}
+static ChaveIdx* ordenar_linhas(const LinhaTmp* v, size_t n){
+    ChaveIdx* ord=malloc((n? n:1)*sizeof *ord); ChaveIdx* tmp=malloc((n? n:1)*sizeof *tmp);
+    if(!ord || !tmp) die("malloc radix");
+    for(size_t i=0;i<n;i++){ ord[i].chave=chave_radix(v[i].id_produto); ord[i].idx=i; }
+    radix_ordenar(ord,tmp,n);
+    for(size_t i=0;i<n;i++) ord[i].chave=chave_radix(v[ord[i].idx].id_pedido);
+    radix_ordenar(ord,tmp,n);
+    free(tmp);
+    return ord;
+}
+static ChaveIdx* ordenar_chaves(const int64_t* v, size_t n){
+    ChaveIdx* ord=malloc((n? n:1)*sizeof *ord); ChaveIdx* tmp=malloc((n? n:1)*sizeof *tmp);
+    if(!ord || !tmp) die("malloc radix");
+    for(size_t i=0;i<n;i++){ ord[i].chave=chave_radix(v[i]); ord[i].idx=i; }
+    radix_ordenar(ord,tmp,n);
+    free(tmp);
+    return ord;
+}
+
+static uint64_t fnv1a(uint64_t h, const void* p, size_t n){
+    const unsigned char* b=p;
+    while(n--){ h^=*b++; h*=0x100000001b3ULL; }
+    return h;
+}
+static int escrever_soma(FILE* f, const void* p, size_t n, uint64_t* soma){
+    if(soma) *soma=fnv1a(*soma,p,n);
+    return fwrite(p,1,n,f)==n;
+}
+
+static const char* dic_path(int qual){ return qual==DIC_CAT? PATH_JOIAS_CAT_DIC : PATH_JOIAS_MARCA_DIC; }
+
+static void dic_liberar(Dicionario* d){
+    free(d->v); free(d->tab);
+    memset(d,0,sizeof *d);
+}
+static size_t dic_slot(const Dicionario* d, const char* valor){
+    size_t m=d->cap_tab-1, i=(size_t)fnv1a(FNV_BASE,valor,strnlen(valor,DIC_VALOR))&m;
+    while(d->tab[i] && strncmp(d->v[d->tab[i]-1],valor,DIC_VALOR)!=0) i=(i+1)&m;
+    return i;
+}
+static void dic_reconstruir(Dicionario* d){
+    free(d->tab);
+    d->cap_tab=64; while(d->cap_tab < d->n*2+2) d->cap_tab<<=1;
+    d->tab=calloc(d->cap_tab,sizeof *d->tab); if(!d->tab) die("malloc dicionario");
+    for(size_t i=0;i<d->n;i++) d->tab[dic_slot(d,d->v[i])]=(uint32_t)(i+1);
+}
+static size_t dic_indice(Dicionario* d, const char* valor, size_t limite){
+    if(!d->tab) dic_reconstruir(d);
+    size_t i=dic_slot(d,valor);
+    if(d->tab[i]) return d->tab[i]-1;
+    if(d->n==limite) return limite;
+    if(d->n==d->cap){
+        d->cap=d->cap? d->cap*2 : 64;
+        d->v=realloc(d->v,d->cap*sizeof *d->v); if(!d->v) die("realloc dicionario");
+    }
+    memset(d->v[d->n],0,DIC_VALOR);
+    strncpy(d->v[d->n],valor,DIC_VALOR);
+    d->n++;
+    if((d->n+1)*2 > d->cap_tab) dic_reconstruir(d);
+    else d->tab[i]=(uint32_t)d->n;
+    return d->n-1;
+}
+static uint16_t dic_codigo(Dicionario* d, const char* valor){
+    return (uint16_t)dic_indice(d,valor,DIC_MAX);
+}
+static uint16_t dic_buscar(Dicionario* d, const char* valor){
+    if(!d->n) return DIC_MAX;
+    if(!d->tab) dic_reconstruir(d);
+    size_t i=dic_slot(d,valor);
+    return d->tab[i]? (uint16_t)(d->tab[i]-1) : DIC_MAX;
+}
+typedef struct { const void* p; size_t tam, n; } ParteArq;
+
+static void gravar_atomico(const char* nome, const ParteArq* partes, size_t np){
+    char path[GER_CAMINHO], tmp[GER_CAMINHO+32]; ger_arq(path,nome);
+    snprintf(tmp,sizeof tmp,"%s.%ld.tmp",path,(long)getpid());
+    FILE* f=fopen(tmp,"wb"); if(!f) die(tmp);
+    int ok=1;
+    for(size_t i=0;i<np && ok;i++) ok=fwrite(partes[i].p,partes[i].tam,partes[i].n,f)==partes[i].n;
+    if(fclose(f)!=0 || !ok){ remove(tmp); die(tmp); }
+    if(rename(tmp,path)!=0){ remove(tmp); die(path); }
+}
+
+static void dic_gravar(const Dicionario* d, int qual){
+    uint64_t n=d->n;
+    ParteArq partes[]={ {DIC_MAGIC,1,8}, {&n,sizeof n,1}, {d->v,DIC_VALOR,d->n} };
+    gravar_atomico(dic_path(qual),partes,3);
+}
+static int dic_carregar(Dicionario* d, int qual){
+    memset(d,0,sizeof *d);
+    char path[GER_CAMINHO];
+    FILE* f=fopen(ger_arq(path,dic_path(qual)),"rb"); if(!f) return 0;
+    char mg[8]; uint64_t n;
+    int ok=fread(mg,1,8,f)==8 && memcmp(mg,DIC_MAGIC,8)==0 && fread(&n,sizeof n,1,f)==1 && n<=DIC_MAX;
+    if(ok){
+        d->n=d->cap=(size_t)n;
+        d->v=malloc((d->n? d->n:1)*sizeof *d->v); if(!d->v) die("malloc dicionario");
+        ok=fread(d->v,DIC_VALOR,d->n,f)==d->n;
+        if(!ok) dic_liberar(d);
+    }
+    fclose(f);
+    return ok;
+}
+
+static void joias_layout(LayoutJoias* l, int fmt, uint32_t paginas){
+    l->fmt=fmt; l->paginas=(fmt==JOIAS_FMT_PAG? paginas : 0);
+    l->tam=(fmt==JOIAS_FMT_FIXO? sizeof(Produto) : sizeof(ProdutoCod));
+    if(fmt==JOIAS_FMT_PAG){
+        l->ini=PAGINA; l->tam_bloco=(size_t)paginas*PAGINA; l->passo=l->tam_bloco/l->tam;
+    }else if(fmt==JOIAS_FMT_CMP){
+        l->ini=JOIAS_CMP_CAB; l->passo=JOIAS_INDEX_STEP; l->tam_bloco=l->passo*l->tam;
+    }else{
+        l->ini=(fmt==JOIAS_FMT_COD? 8 : 0); l->passo=JOIAS_INDEX_STEP; l->tam_bloco=l->passo*l->tam;
+    }
+}
+static uint64_t joias_offset(const LayoutJoias* l, uint64_t rec){
+    return l->ini+rec/l->passo*l->tam_bloco+rec%l->passo*l->tam;
+}
+static uint64_t joias_n_registros(const LayoutJoias* l, uint64_t tam_arq){
+    if(tam_arq<=l->ini) return 0;
+    uint64_t d=tam_arq-l->ini, b=d/l->tam_bloco, r=(d-b*l->tam_bloco)/l->tam;
+    return b*l->passo+(r<l->passo? r : l->passo);
+}
+static size_t joias_off_preco(int fmt){ return fmt!=JOIAS_FMT_FIXO? offsetof(ProdutoCod,preco) : offsetof(Produto,preco); }
+static void joias_formato(FILE* f, LayoutJoias* l){
+    char mg[8]; uint32_t paginas=0;
+    int fmt=JOIAS_FMT_FIXO;
+    if(fseek(f,0,SEEK_SET)!=0) die("seek joias");
+    if(fread(mg,1,sizeof mg,f)==sizeof mg){
+        if(memcmp(mg,JOIAS_MAGIC,sizeof mg)==0) fmt=JOIAS_FMT_COD;
+        else if(memcmp(mg,JOIAS_PAG_MAGIC,sizeof mg)==0 && fread(&paginas,sizeof paginas,1,f)==1 &&
+                paginas>=1 && paginas<=JOIAS_PAGINAS_MAX) fmt=JOIAS_FMT_PAG;
+        else if(memcmp(mg,JOIAS_CMP_MAGIC,sizeof mg)==0 && fread(&paginas,sizeof paginas,1,f)==1 &&
+                paginas==JOIAS_INDEX_STEP) fmt=JOIAS_FMT_CMP;
+    }
+    joias_layout(l,fmt,paginas);
+    if(fseek(f,(long)l->ini,SEEK_SET)!=0) die("seek joias");
+}
+static void joias_cabecalho(FILE* f, const LayoutJoias* l, uint64_t* soma){
+    if(l->fmt==JOIAS_FMT_COD && !escrever_soma(f,JOIAS_MAGIC,8,soma)) die("w cabecalho joias");
+    if(l->fmt==JOIAS_FMT_PAG){
+        unsigned char cab[PAGINA];
+        memset(cab,0,sizeof cab);
+        memcpy(cab,JOIAS_PAG_MAGIC,8);
+        memcpy(cab+8,&l->paginas,sizeof l->paginas);
+        if(!escrever_soma(f,cab,sizeof cab,soma)) die("w cabecalho joias");
+    }
+    if(l->fmt==JOIAS_FMT_CMP){
+        unsigned char cab[JOIAS_CMP_CAB];
+        uint32_t passo=(uint32_t)l->passo;
+        memset(cab,0,sizeof cab);
+        memcpy(cab,JOIAS_CMP_MAGIC,8);
+        memcpy(cab+8,&passo,sizeof passo);
+        if(!escrever_soma(f,cab,sizeof cab,soma)) die("w cabecalho joias");
+    }
+}
+static size_t varint_escrever(unsigned char* b, uint64_t v){
+    size_t k=0;
+    while(v>=0x80){ b[k++]=(unsigned char)(v|0x80); v>>=7; }
+    b[k++]=(unsigned char)v;
+    return k;
+}
+static size_t varint_ler(const unsigned char* b, size_t len, uint64_t* v){
+    *v=0;
+    for(size_t k=0;k<len && k<10;k++){
+        *v|=(uint64_t)(b[k]&0x7f)<<(7*k);
+        if(!(b[k]&0x80)) return k+1;
+    }
+    return 0;
+}
+static size_t joias_cmp_codificar(unsigned char* b, int inicio, const ProdutoCod* ant, const ProdutoCod* c){
+    size_t k=0, nl=strnlen(c->nome,NOME_MAX), pre=0;
+    if(inicio){ memcpy(b,&c->id_produto,sizeof c->id_produto); k=sizeof c->id_produto; }
+    else{
+        k=varint_escrever(b,(uint64_t)c->id_produto-(uint64_t)ant->id_produto);
+        while(pre<nl && ant->nome[pre]==c->nome[pre]) pre++;
+    }
+    k+=varint_escrever(b+k,c->cod_categoria);
+    k+=varint_escrever(b+k,c->cod_marca);
+    k+=varint_escrever(b+k,pre);
+    k+=varint_escrever(b+k,nl-pre);
+    memcpy(b+k,c->nome+pre,nl-pre); k+=nl-pre;
+    memcpy(b+k,&c->preco,sizeof c->preco);
+    return k+sizeof c->preco;
+}
+static size_t joias_cmp_decodificar(const unsigned char* b, size_t len, int inicio, const ProdutoCod* ant, ProdutoCod* r){
+    size_t k=0, t;
+    uint64_t v[5];
+    int64_t id;
+    if(inicio){
+        if(len<sizeof id) return 0;
+        memcpy(&id,b,sizeof id); k=sizeof id;
+    }else{
+        if(!(t=varint_ler(b,len,&v[0]))) return 0;
+        id=(int64_t)((uint64_t)ant->id_produto+v[0]); k=t;
+    }
+    for(int i=1;i<5;i++){
+        if(!(t=varint_ler(b+k,len-k,&v[i]))) return 0;
+        k+=t;
+    }
+    if(v[1]>UINT16_MAX || v[2]>UINT16_MAX || (inicio && v[3]) || v[3]>NOME_MAX || v[4]>NOME_MAX-v[3] || len-k<v[4]+sizeof r->preco) return 0;
+    if(r!=ant && v[3]) memcpy(r->nome,ant->nome,(size_t)v[3]);
+    memcpy(r->nome+v[3],b+k,(size_t)v[4]); k+=(size_t)v[4];
+    memset(r->nome+v[3]+v[4],0,NOME_MAX-(size_t)(v[3]+v[4]));
+    memcpy(&r->preco,b+k,sizeof r->preco);
+    r->id_produto=id; r->cod_categoria=(uint16_t)v[1]; r->cod_marca=(uint16_t)v[2];
+    return k+sizeof r->preco;
+}
+static size_t joias_cmp_bloco(const unsigned char* b, size_t len, size_t passo, unsigned char* out){
+    ProdutoCod* v=(ProdutoCod*)out;
+    size_t n=0, pos=0, k;
+    while(n<passo && pos<len && (k=joias_cmp_decodificar(b+pos,len-pos,n==0,n? &v[n-1] : NULL,&v[n]))){ pos+=k; n++; }
+    return n;
+}
+static int joias_escrever(FILE* f, const LayoutJoias* l, uint64_t rec, Dicionario* dic, const Produto* p, ProdutoCod* ant, uint64_t* soma){
+    size_t sobra=l->tam_bloco-l->passo*l->tam;
+    if(sobra && rec && rec%l->passo==0){
+        static const unsigned char zeros[PAGINA];
+        if(!escrever_soma(f,zeros,sobra,soma)) return 0;
+    }
+    if(l->fmt==JOIAS_FMT_FIXO) return escrever_soma(f,p,sizeof *p,soma);
+    ProdutoCod c;
+    memset(&c,0,sizeof c);
+    c.id_produto=p->id_produto;
+    c.cod_categoria=dic_codigo(&dic[DIC_CAT],p->categoria);
+    c.cod_marca=dic_codigo(&dic[DIC_MARCA],p->marca);
+    if(c.cod_categoria==DIC_MAX || c.cod_marca==DIC_MAX) return JOIAS_DIC_CHEIO;
+    memcpy(c.nome,p->nome,NOME_MAX);
+    c.preco=p->preco;
+    if(l->fmt==JOIAS_FMT_CMP){
+        unsigned char b[JOIAS_CMP_REG_MAX];
+        size_t k=joias_cmp_codificar(b,rec%l->passo==0,ant,&c);
+        *ant=c;
+        return escrever_soma(f,b,k,soma);
+    }
+    return escrever_soma(f,&c,sizeof c,soma);
+}
+static void joias_decodificar(const Dicionario* dic, const void* rec, Produto* p){
+    if(!dic){ memcpy(p,rec,sizeof *p); return; }
+    const ProdutoCod* c=rec;
+    p->id_produto=c->id_produto;
+    if(c->cod_categoria<dic[DIC_CAT].n) memcpy(p->categoria,dic[DIC_CAT].v[c->cod_categoria],CAT_MAX);
+    else memset(p->categoria,0,CAT_MAX);
+    if(c->cod_marca<dic[DIC_MARCA].n) memcpy(p->marca,dic[DIC_MARCA].v[c->cod_marca],MARCA_MAX);
+    else memset(p->marca,0,MARCA_MAX);
+    memcpy(p->nome,c->nome,NOME_MAX);
+    p->preco=c->preco;
+}
+
+static void pedvar_reservar(PedidoVar* p, size_t n){
+    if(n<=p->cap) return;
+    size_t cap=p->cap? p->cap:16;
+    while(cap<n) cap*=2;
+    int64_t* v=realloc(p->ids_produtos,cap*sizeof *v); if(!v) die("realloc itens pedido");
+    p->ids_produtos=v; p->cap=cap;
+}
+static void pedvar_free(PedidoVar* p){
+    free(p->ids_produtos);
+    memset(p,0,sizeof *p);
+}
+static uint64_t ped_inicio(int fmt){ return fmt==PED_FMT_VAR? 8 : 0; }
+static int ped_formato(FILE* f){
+    char mg[8];
+    if(fseek(f,0,SEEK_SET)!=0) die("seek pedidos");
+    if(fread(mg,1,sizeof mg,f)==sizeof mg && memcmp(mg,PEDIDOS_MAGIC,sizeof mg)==0) return PED_FMT_VAR;
+    if(fseek(f,0,SEEK_SET)!=0) die("seek pedidos");
+    return PED_FMT_FIXO;
+}
+static void ped_cabecalho(FILE* f, int fmt, uint64_t* soma){
+    if(fmt==PED_FMT_VAR && !escrever_soma(f,PEDIDOS_MAGIC,8,soma)) die("w cabecalho pedidos");
+}
+static int ped_ler(FILE* f, int fmt, PedidoVar* p){
+    if(fmt==PED_FMT_FIXO){
+        Pedido ped;
+        if(fread(&ped,sizeof ped,1,f)!=1) return 0;
+        if(ped.n_itens<0 || ped.n_itens>MAX_ITENS_PEDIDO) return 0;
+        pedvar_reservar(p,(size_t)ped.n_itens);
+        p->id_pedido=ped.id_pedido; p->n_itens=ped.n_itens;
+        if(ped.n_itens) memcpy(p->ids_produtos,ped.ids_produtos,(size_t)ped.n_itens*sizeof(int64_t));
+        return 1;
+    }
+    unsigned char cab[PEDVAR_CAB];
+    if(fread(cab,1,PEDVAR_CAB,f)!=PEDVAR_CAB) return 0;
+    memcpy(&p->id_pedido,cab,sizeof(int64_t)); memcpy(&p->n_itens,cab+sizeof(int64_t),sizeof(int32_t));
+    if(p->n_itens<0) return 0;
+    pedvar_reservar(p,(size_t)p->n_itens);
+    return fread(p->ids_produtos,sizeof(int64_t),(size_t)p->n_itens,f)==(size_t)p->n_itens;
+}
+static size_t ped_decodificar(const unsigned char* b, size_t len, int fmt, PedidoVar* p){
+    if(fmt==PED_FMT_FIXO){
+        if(len<sizeof(Pedido)) return 0;
+        memcpy(&p->id_pedido,b+offsetof(Pedido,id_pedido),sizeof(int64_t));
+        memcpy(&p->n_itens,b+offsetof(Pedido,n_itens),sizeof(int32_t));
+        if(p->n_itens<0 || p->n_itens>MAX_ITENS_PEDIDO) return 0;
+        pedvar_reservar(p,(size_t)p->n_itens);
+        if(p->n_itens) memcpy(p->ids_produtos,b+offsetof(Pedido,ids_produtos),(size_t)p->n_itens*sizeof(int64_t));
+        return sizeof(Pedido);
+    }
+    if(len<PEDVAR_CAB) return 0;
+    memcpy(&p->id_pedido,b,sizeof(int64_t)); memcpy(&p->n_itens,b+sizeof(int64_t),sizeof(int32_t));
+    if(p->n_itens<0 || (size_t)p->n_itens>(len-PEDVAR_CAB)/sizeof(int64_t)) return 0;
+    pedvar_reservar(p,(size_t)p->n_itens);
+    if(p->n_itens) memcpy(p->ids_produtos,b+PEDVAR_CAB,(size_t)p->n_itens*sizeof(int64_t));
+    return PEDVAR_CAB+(size_t)p->n_itens*sizeof(int64_t);
+}
+static int ped_escrever(FILE* f, int fmt, int64_t id, int32_t n, const int64_t* ids, uint64_t* soma){
+    if(fmt==PED_FMT_FIXO){
+        if(n>MAX_ITENS_PEDIDO) return 0;
+        Pedido ped;
+        memset(&ped,0,sizeof ped);
+        ped.id_pedido=id; ped.n_itens=n;
+        if(n) memcpy(ped.ids_produtos,ids,(size_t)n*sizeof *ids);
+        return escrever_soma(f,&ped,sizeof ped,soma);
+    }
+    if(!escrever_soma(f,&id,sizeof id,soma) || !escrever_soma(f,&n,sizeof n,soma)) return 0;
+    return n==0 || escrever_soma(f,ids,(size_t)n*sizeof *ids,soma);
+}
+
+static size_t ped_espiar(const unsigned char* b, size_t len, int fmt, int64_t* id){
+    if(fmt==PED_FMT_FIXO){
+        if(len<sizeof(Pedido)) return 0;
+        memcpy(id,b+offsetof(Pedido,id_pedido),sizeof *id);
+        return sizeof(Pedido);
+    }
+    int32_t n;
+    if(len<PEDVAR_CAB) return 0;
+    memcpy(id,b,sizeof *id); memcpy(&n,b+sizeof(int64_t),sizeof n);
+    if(n<0 || (size_t)n>(len-PEDVAR_CAB)/sizeof(int64_t)) return 0;
+    return PEDVAR_CAB+(size_t)n*sizeof(int64_t);
+}
+static size_t pidx_passo(FILE* f){
+    PedidosIdxCab cab;
+    if(fseek(f,0,SEEK_SET)!=0) die("seek pedidos.idx");
+    if(fread(&cab,sizeof cab,1,f)==1 && memcmp(cab.magic,PEDIDOS_IDX_MAGIC,sizeof cab.magic)==0 &&
+       cab.passo>=2 && cab.passo<=PEDIDOS_IDX_PASSO_MAX) return (size_t)cab.passo;
+    return 1;
+}
+static void pidx_cabecalho(FILE* f, size_t passo){
+    if(passo<=1) return;
+    PedidosIdxCab cab; memcpy(cab.magic,PEDIDOS_IDX_MAGIC,sizeof cab.magic); cab.passo=passo;
+    if(fwrite(&cab,sizeof cab,1,f)!=1) die("w cabecalho pedidos.idx");
+}
+static void pidx_amostrar(FILE* f, size_t passo, uint64_t rec, int64_t id, uint64_t off){
+    if(rec%passo) return;
+    PedidosIdxEntry e; e.id_pedido=id; e.offset=off;
+    if(fwrite(&e,sizeof e,1,f)!=1) die("w pedidos.idx");
+}
+
+static void meta_iniciar(TabelaMeta* m, uint32_t formato){
+    memset(m,0,sizeof *m);
+    memcpy(m->magic,META_MAGIC,sizeof m->magic);
+    m->versao=META_VERSAO;
+    m->formato=formato;
+    m->checksum=FNV_BASE;
+}
+static void meta_registro(TabelaMeta* m, int64_t chave){
+    if(!m->n_registros || chave<m->min_chave) m->min_chave=chave;
+    if(!m->n_registros || chave>m->max_chave) m->max_chave=chave;
+    m->n_registros++;
+}
+static void meta_estado(FILE* dados, TabelaMeta* m){
+    struct stat sb;
+    if(fstat(fileno(dados),&sb)!=0) die("fstat meta");
+    m->tam_bytes=(uint64_t)sb.st_size;
+    m->mtime_ns=(int64_t)sb.st_mtim.tv_sec*1000000000+sb.st_mtim.tv_nsec;
+}
+static uint64_t meta_bordas(FILE* dados, uint64_t tam){
+    unsigned char buf[META_BORDA];
+    uint64_t h=FNV_BASE;
+    uint64_t ini[2]={0, tam>META_BORDA? tam-META_BORDA : 0};
+    for(int i=0;i<(tam>META_BORDA? 2:1);i++){
+        size_t n=(size_t)(tam-ini[i]<META_BORDA? tam-ini[i] : META_BORDA);
+        if(pread(fileno(dados),buf,n,(off_t)ini[i])!=(ssize_t)n) die("r meta");
+        h=fnv1a(h,buf,n);
+    }
+    return h;
+}
+static void meta_gravar(const char* nome, TabelaMeta* m, FILE* dados){
+    if(fflush(dados)!=0) die("flush meta");
+    meta_estado(dados,m);
+    m->checksum_bordas=meta_bordas(dados,m->tam_bytes);
+    ParteArq parte={m,sizeof *m,1};
+    gravar_atomico(nome,&parte,1);
+}
+static int meta_ler(const char* nome, TabelaMeta* m){
+    char path[GER_CAMINHO];
+    FILE* f=fopen(ger_arq(path,nome),"rb"); if(!f) return 0;
+    int ok=fread(m,sizeof *m,1,f)==1 && memcmp(m->magic,META_MAGIC,sizeof m->magic)==0 && m->versao==META_VERSAO;
+    fclose(f);
+    return ok;
+}
+static void cursor_abrir(Cursor* c, FILE* f, Mapa* m, const LayoutJoias* l);
+static const void* cursor_prox(Cursor* c);
+static void cursor_fechar(Cursor* c);
+
+static void meta_calcular(FILE* f, int tabela, TabelaMeta* m){
+    if(tabela==TAB_JOIAS){
+        LayoutJoias l; joias_formato(f,&l);
+        meta_iniciar(m,(uint32_t)l.fmt);
+        int64_t id;
+        if(l.fmt==JOIAS_FMT_CMP){
+            Cursor c; cursor_abrir(&c,f,NULL,&l);
+            const void* rec;
+            while((rec=cursor_prox(&c))){ memcpy(&id,rec,sizeof id); meta_registro(m,id); }
+            cursor_fechar(&c);
+        }else{
+            uint64_t n=joias_n_registros(&l,fsize(f));
+            if(n && fseek(f,(long)l.ini,SEEK_SET)==0 && fread(&id,sizeof id,1,f)==1) meta_registro(m,id);
+            if(n>1 && fseek(f,(long)joias_offset(&l,n-1),SEEK_SET)==0 && fread(&id,sizeof id,1,f)==1) meta_registro(m,id);
+            m->n_registros=n;
+        }
+    }else{
+        int fmt=ped_formato(f);
+        meta_iniciar(m,(uint32_t)fmt);
+        PedidoVar ped; memset(&ped,0,sizeof ped);
+        while(ped_ler(f,fmt,&ped)) meta_registro(m,ped.id_pedido);
+        pedvar_free(&ped);
+    }
+    unsigned char buf[65536]; size_t rd;
+    if(fseek(f,0,SEEK_SET)!=0) die("seek meta");
+    while((rd=fread(buf,1,sizeof buf,f))>0) m->checksum=fnv1a(m->checksum,buf,rd);
+}
+static int meta_carregar(FILE* f, const char* path, int tabela, TabelaMeta* m){
+    if(!f){ memset(m,0,sizeof *m); return 0; }
+    TabelaMeta atual; meta_estado(f,&atual);
+    if(meta_ler(path,m) && m->tam_bytes==atual.tam_bytes && m->mtime_ns==atual.mtime_ns
+       && m->checksum_bordas==meta_bordas(f,atual.tam_bytes)) return 0;
+    meta_calcular(f,tabela,m);
+    meta_estado(f,m);
+    m->checksum_bordas=meta_bordas(f,m->tam_bytes);
+    return 1;
+}
+
 static void build_nome(char* out, size_t cap, const char* categoria, const char* cor, const char* metal, const char* pedra){
     char tmp[256]="";
     const char* cat = categoria? categoria:"";
@@ -131,360 +931,2461 @@ static void build_nome(char* out, size_t cap, const char* categoria, const char*
     safe_copy(out, cap, tmp);
 }
 
-static void write_joias(ProdutoTmp* v, size_t n){
-    if(!n) return;
-    qsort(v,n,sizeof *v, cmp_produto_id);
-    size_t w=0;
-    for(size_t i=0;i<n;i++){
-        if(w==0 || v[i].id_produto!=v[w-1].id_produto){
-            if(w!=i) v[w]=v[i];
-            w++;
-        }
-    }
-    FILE* f=fopen(PATH_JOIAS,"wb"); if(!f) die("joias.dat");
-    Produto p;
-    for(size_t i=0;i<w;i++){
-        memset(&p,0,sizeof p);
-        p.id_produto=v[i].id_produto;
-        safe_copy(p.categoria,CAT_MAX,v[i].categoria);
-        safe_copy(p.marca,MARCA_MAX,v[i].marca);
-        safe_copy(p.nome,NOME_MAX,v[i].nome);
-        p.preco=v[i].preco;
-        if(fwrite(&p,sizeof p,1,f)!=1) die("w joias");
-    }
-    fclose(f);
-    printf("joias.dat: %zu produtos únicos\n", w);
+static void joias_idx_amostrar(FILE* idx, const LayoutJoias* l, uint64_t rec, int64_t id, FILE* dat){
+    if(rec % l->passo) return;
+    JoiasIdxEntry e; e.id_base=id; e.offset=(l->fmt==JOIAS_FMT_CMP? (uint64_t)ftell(dat) : joias_offset(l,rec));
+    if(fwrite(&e,sizeof e,1,idx)!=1) die("w joias.idx");
 }
 
-static void write_pedidos_and_index(LinhaTmp* v, size_t n){
-    if(!n) return;
-    qsort(v,n,sizeof *v, cmp_linha_by_pedido_then_prod);
-    FILE* f = fopen(PATH_PEDIDOS, "wb"); if(!f) die("pedidos.dat");
-    FILE* idx = fopen(PATH_PEDIDOS_IDX, "wb"); if(!idx) die("pedidos.idx");
+static const char* sec_path(int campo){ return campo==SEC_NOME? PATH_JOIAS_NOME_IDX : PATH_JOIAS_CAT_IDX; }
 
+static void sec_normalizar(char* out, const char* valor){
     size_t i=0;
-    while(i<n){
-        int64_t cur_ped = v[i].id_pedido;
-        int64_t total = 0;
-        size_t j=i;
-        while(j<n && v[j].id_pedido==cur_ped){
-            if(v[j].quantidade>0) total += v[j].quantidade;
-            j++;
-        }
-        if(total > MAX_ITENS_PEDIDO) { fprintf(stderr, "Pedido %lld tem %lld itens (max=%d). Truncando.\n", (long long)cur_ped, (long long)total, MAX_ITENS_PEDIDO); total = MAX_ITENS_PEDIDO; }
-        long off = ftell(f);
-        Pedido ped;
-        memset(&ped, 0, sizeof(Pedido));
-        ped.id_pedido=cur_ped;
-        ped.n_itens=(int32_t)total;
-        int idx_item=0;
-        for(size_t k=i; k<j && idx_item<MAX_ITENS_PEDIDO; ++k){
-            for(int q=0; q<v[k].quantidade && idx_item<MAX_ITENS_PEDIDO; ++q){
-                ped.ids_produtos[idx_item++] = v[k].id_produto;
-            }
-        }
-        if(fwrite(&ped, sizeof ped, 1, f)!=1){ fclose(f); fclose(idx); die("w pedido"); }
-        PedidosIdxEntry e; e.id_pedido = cur_ped; e.offset = (uint64_t)off;
-        if(fwrite(&e, sizeof e, 1, idx)!=1) { fclose(f); fclose(idx); die("w idx"); }
-        i = j;
-    }
-    fclose(f); fclose(idx);
-    printf("pedidos.dat: gravado e indexado.\n");
-}
-
-static void build_joias_idx(void){
-    FILE* f=fopen(PATH_JOIAS,"rb"); if(!f) die("open joias.dat");
-    FILE* idx=fopen(PATH_JOIAS_IDX,"wb"); if(!idx) die("open joias.idx");
-    size_t nrec=fsize(f)/sizeof(Produto);
-    Produto p; JoiasIdxEntry e;
-    for(size_t i=0;i<nrec;i+=JOIAS_INDEX_STEP){
-        if(fseek(f,(long)(i*sizeof(Produto)),SEEK_SET)!=0) die("seek joias");
-        if(fread(&p,sizeof p,1,f)!=1) break;
-        e.id_base=p.id_produto; e.offset=(uint64_t)(i*sizeof(Produto));
-        if(fwrite(&e,sizeof e,1,idx)!=1) die("w joias.idx");
-    }
-    fclose(f); fclose(idx);
-    printf("joias.idx: ok (step=%d)\n", JOIAS_INDEX_STEP);
-}
-
-static void rebuild_pedidos_idx(void){
-    FILE* f=fopen(PATH_PEDIDOS,"rb"); if(!f) die("open pedidos.dat");
-    FILE* idx=fopen(PATH_PEDIDOS_IDX,"wb"); if(!idx) die("open pedidos.idx");
-    while(1){
-        long off=ftell(f);
-        Pedido ped; size_t rd=fread(&ped, sizeof ped, 1, f);
-        if(rd!=1) break;
-        PedidosIdxEntry e; e.id_pedido=ped.id_pedido; e.offset=(uint64_t)off;
-        if(fwrite(&e,sizeof e,1,idx)!=1) die("w pedidos.idx");
-    }
-    fclose(f); fclose(idx);
-    printf("pedidos.idx: reconstruído.\n");
-}
-
-static void cmd_import(const char* csv){
-    FILE* in=fopen(csv,"r"); if(!in) die("open CSV");
-    size_t capP=2048,nP=0, capL=4096,nL=0;
-    ProdutoTmp* prods=malloc(capP*sizeof *prods); if(!prods) die("malloc prods");
-    LinhaTmp*   linhas=malloc(capL*sizeof *linhas); if(!linhas) die("malloc linhas");
-
-    char line[8192], cell[16384]; char* col[32];
-    size_t ok=0, skip=0;
-    while(fgets(line,sizeof line,in)){
-        rstrip(line); if(!line[0]) continue;
-        int nf=parse_csv_line(line,col,32,cell,sizeof cell);
-        if(nf<0){ skip++; continue; }
-        if(nf<8){ skip++; continue; }
-
-        int64_t order_id=0, prod_id=0; int32_t qty=0; double price=0.0;
-        const char* s_order = (nf>1? col[1]:"");
-        const char* s_prod  = (nf>2? col[2]:"");
-        const char* s_qty   = (nf>3? col[3]:"");
-        const char* s_cat   = (nf>5? col[5]:"");
-        const char* s_price = (nf>7? col[7]:"");
-        const char* s_cor   = (nf>10? col[10]:"");
-        const char* s_metal = (nf>11? col[11]:"");
-        const char* s_pedra = (nf>12? col[12]:"");
-
-        if(!try_i64(s_order,&order_id) || !try_i64(s_prod,&prod_id) || !try_i32(s_qty,&qty) || !try_f64(s_price,&price)){
-            skip++; continue;
-        }
-
-        if(nP==capP){ capP*=2; prods=realloc(prods,capP*sizeof *prods); if(!prods) die("realloc prods"); }
-        prods[nP].id_produto=prod_id;
-        safe_copy(prods[nP].categoria,CAT_MAX, s_cat);
-        safe_copy(prods[nP].marca,MARCA_MAX, s_metal?s_metal:"");
-        build_nome(prods[nP].nome,NOME_MAX, s_cat,s_cor,s_metal,s_pedra);
-        prods[nP].preco=price; nP++;
-
-        if(nL==capL){ capL*=2; linhas=realloc(linhas,capL*sizeof *linhas); if(!linhas) die("realloc linhas"); }
-        linhas[nL].id_pedido=order_id; linhas[nL].id_produto=prod_id; linhas[nL].quantidade=qty; nL++;
-
-        ok++;
-    }
-    fclose(in);
-    printf("CSV lido: %zu válidas, %zu puladas\n", ok, skip);
-
-    write_joias(prods,nP);
-    write_pedidos_and_index(linhas,nL);
-    build_joias_idx();
-    free(prods); free(linhas);
+    for(; valor[i] && i<NOME_MAX-1; i++) out[i]=(char)tolower((unsigned char)valor[i]);
+    memset(out+i,0,NOME_MAX-i);
 }
+static void merge_abrir(MergeRuns* m, FILE** runs, size_t n, size_t tam, int (*cmp)(const void*, const void*));
+static int merge_prox(MergeRuns* m, void* out);
+static void merge_fechar(MergeRuns* m);
+static void runs_anexar(ListaRuns* r, FILE* f);
+static void runs_reduzir(ListaRuns* r, size_t tam, int (*cmp)(const void*, const void*), DupProd* dup);
 
-static void cmd_find_prod(const char* s){
-    int64_t target; if(!try_i64(s,&target)){ fprintf(stderr,"id_produto inválido\n"); return; }
-    FILE* fidx=fopen(PATH_JOIAS_IDX,"rb"); FILE* fdat=fopen(PATH_JOIAS,"rb");
-    if(!fidx||!fdat) die("abrir joias.*");
-    size_t sz=fsize(fidx), n=sz/sizeof(JoiasIdxEntry);
-    if(n==0){ printf("Índice vazio.\n"); goto done; }
+static int cmp_sec_par(const void* a, const void* b){
+    const SecPar* x=a; const SecPar* y=b;
+    int c=strncmp(x->chave,y->chave,NOME_MAX);
+    if(c) return c;
+    return (x->id>y->id)-(x->id<y->id);
+}
+static int cmp_sec_cod(const void* a, const void* b){
+    const SecCod* x=a; const SecCod* y=b;
+    if(x->cod!=y->cod) return x->cod<y->cod? -1 : 1;
+    return (x->id>y->id)-(x->id<y->id);
+}
+static void sec_despejar(SecColetor* c){
+    qsort(c->nomes,c->n_nomes,sizeof *c->nomes,cmp_sec_par);
+    FILE* f=tmpfile(); if(!f) die("tmpfile run");
+    if(fwrite(c->nomes,sizeof *c->nomes,c->n_nomes,f)!=c->n_nomes) die("w run");
+    runs_anexar(&c->runs,f);
+    if(c->runs.n>=IMPORT_MAX_RUNS) runs_reduzir(&c->runs,sizeof(SecPar),cmp_sec_par,NULL);
+    c->n_nomes=0;
     
-    size_t lo=0, hi=n;
-    while(lo<hi){
-        size_t mid=(lo+hi)/2;
-        JoiasIdxEntry entry;
-        if(fseek(fidx,(long)(mid*sizeof(JoiasIdxEntry)),SEEK_SET)!=0) die("seek idx mid");
-        if(fread(&entry,sizeof(JoiasIdxEntry),1,fidx)!=1) die("read idx mid");
-        if(entry.id_base<=target) lo=mid+1; else hi=mid;
+    qsort(c->cods,c->n_cods,sizeof *c->cods,cmp_sec_cod);
+    f=tmpfile(); if(!f) die("tmpfile run");
+    if(fwrite(c->cods,sizeof *c->cods,c->n_cods,f)!=c->n_cods) die("w run");
+    runs_anexar(&c->runs_cods,f);
+    if(c->runs_cods.n>=IMPORT_MAX_RUNS) runs_reduzir(&c->runs_cods,sizeof(SecCod),cmp_sec_cod,NULL);
+    c->n_cods=0;
+}
+static void sec_coletar(SecColetor* c, const Produto* p){
+    if(!c->limite) c->limite=(size_t)config_env("IMPORT_MEM_BUDGET",IMPORT_MEM_BUDGET,1);
+    if(c->n_nomes && (c->n_nomes+1)*(sizeof *c->nomes+sizeof *c->cods) > c->limite) sec_despejar(c);
+    if(c->n_nomes==c->cap_nomes){
+        c->cap_nomes=c->cap_nomes? c->cap_nomes*2 : 1024;
+        c->nomes=realloc(c->nomes,c->cap_nomes*sizeof *c->nomes); if(!c->nomes) die("realloc indice secundario");
     }
-    size_t base=(lo==0?0:lo-1);
+    sec_normalizar(c->nomes[c->n_nomes].chave, p->nome);
+    c->nomes[c->n_nomes++].id=p->id_produto;
     
-    JoiasIdxEntry entry;
-    if(fseek(fidx,(long)(base*sizeof(JoiasIdxEntry)),SEEK_SET)!=0) die("seek idx base");
-    if(fread(&entry,sizeof(JoiasIdxEntry),1,fidx)!=1) die("read idx base");
-    uint64_t start=entry.offset;
-
-    if(fseek(fdat,(long)start,SEEK_SET)!=0) die("seek data");
-    Produto p; size_t cnt=0; int found=0;
-    while(cnt<JOIAS_INDEX_STEP && fread(&p,sizeof p,1,fdat)==1){
-        if(p.id_produto==target){
-            printf("Produto: id=%lld nome=\"%.*s\" cat=\"%.*s\" marca=\"%.*s\" preco=%.2f\n",
-                   (long long)p.id_produto, (int)NOME_MAX, p.nome, (int)CAT_MAX, p.categoria, (int)MARCA_MAX, p.marca, p.preco);
-            found=1; break;
-        }
-        cnt++;
+    char chave[NOME_MAX];
+    sec_normalizar(chave, strncmp(p->categoria,"jewelry.",8)==0? p->categoria+8 : p->categoria);
+    if(c->n_cods==c->cap_cods){
+        c->cap_cods=c->cap_cods? c->cap_cods*2 : 1024;
+        c->cods=realloc(c->cods,c->cap_cods*sizeof *c->cods); if(!c->cods) die("realloc indice secundario");
     }
-    if(!found) printf("Produto %lld não encontrado.\n", (long long)target);
-done: if(fidx) fclose(fidx); if(fdat) fclose(fdat);
+    c->cods[c->n_cods].cod=(uint32_t)dic_indice(&c->cats,chave,SIZE_MAX);
+    c->cods[c->n_cods++].id=p->id_produto;
 }
 
-static void cmd_find_pedido(const char* s){
-    int64_t target; if(!try_i64(s,&target)){ fprintf(stderr,"id_pedido inválido\n"); return; }
-    FILE* idx=fopen(PATH_PEDIDOS_IDX,"rb"); if(!idx){ printf("Índice de pedidos ausente. Faça import/insert/remove primeiro.\n"); return; }
-    size_t sz=fsize(idx), n=sz/sizeof(PedidosIdxEntry);
-    
-    size_t lo=0, hi=n;
-    while(lo<hi){
-        size_t mid=(lo+hi)/2;
-        PedidosIdxEntry entry;
-        if(fseek(idx,(long)(mid*sizeof(PedidosIdxEntry)),SEEK_SET)!=0) die("seek ped.idx mid");
-        if(fread(&entry,sizeof(PedidosIdxEntry),1,idx)!=1) die("read ped.idx mid");
-        if(entry.id_pedido<target) lo=mid+1; else hi=mid;
+static void sec_saida_abrir(SecSaida* o, int campo, uint64_t checksum, SecIdx* mem){
+    memset(o,0,sizeof *o);
+    memcpy(o->cab.magic,SECIDX_MAGIC,sizeof o->cab.magic);
+    o->cab.checksum=checksum;
+    o->mem=mem;
+    if(mem){ memset(mem,0,sizeof *mem); return; }
+    ger_arq(o->path,sec_path(campo));
+    snprintf(o->tmp,sizeof o->tmp,"%s.%ld.tmp",o->path,(long)getpid());
+    o->f=fopen(o->tmp,"wb"); if(!o->f) die(o->tmp);
+    o->ids=tmpfile(); if(!o->ids) die("tmpfile indice secundario");
+    if(fwrite(&o->cab,sizeof o->cab,1,o->f)!=1) die(o->tmp);
+}
+static void sec_saida_entrada(SecSaida* o){
+    if(!o->e.n) return;
+    if(!o->mem){ if(fwrite(&o->e,sizeof o->e,1,o->f)!=1) die(o->tmp); return; }
+    SecIdx* s=o->mem;
+    if(s->n_chaves==o->cap_dir){
+        o->cap_dir=o->cap_dir? o->cap_dir*2 : 256;
+        s->dir=realloc(s->dir,o->cap_dir*sizeof *s->dir); if(!s->dir) die("realloc indice secundario");
     }
-    
-    if(lo==n){
-        printf("Pedido %lld não encontrado.\n",(long long)target);
-        fclose(idx);
-        return;
+    s->dir[s->n_chaves++]=o->e;
+}
+static void sec_saida_par(SecSaida* o, const char* chave, int64_t id){
+    if(o->e.n && strncmp(chave,o->e.chave,NOME_MAX)==0) o->e.n++;
+    else{
+        sec_saida_entrada(o);
+        memcpy(o->e.chave,chave,NOME_MAX); o->e.ini=o->cab.n_ids; o->e.n=1;
+        o->cab.n_chaves++;
     }
-    
-    PedidosIdxEntry found_entry;
-    if(fseek(idx,(long)(lo*sizeof(PedidosIdxEntry)),SEEK_SET)!=0) die("seek ped.idx found");
-    if(fread(&found_entry,sizeof(PedidosIdxEntry),1,idx)!=1) die("read ped.idx found");
-    
-    if(found_entry.id_pedido!=target){
-        printf("Pedido %lld não encontrado.\n",(long long)target);
-        fclose(idx);
-        return;
+    o->cab.n_ids++;
+    if(!o->mem){ if(fwrite(&id,sizeof id,1,o->ids)!=1) die("w indice secundario"); return; }
+    SecIdx* s=o->mem;
+    if(s->n_ids==o->cap_ids){
+        o->cap_ids=o->cap_ids? o->cap_ids*2 : 1024;
+        s->ids=realloc(s->ids,o->cap_ids*sizeof *s->ids); if(!s->ids) die("realloc indice secundario");
     }
-    
-    uint64_t off=found_entry.offset;
-    fclose(idx);
-
-    FILE* f=fopen(PATH_PEDIDOS,"rb"); if(!f) die("open pedidos.dat");
-    if(fseek(f,(long)off,SEEK_SET)!=0) die("seek ped");
-    Pedido ped; if(fread(&ped,sizeof ped,1,f)!=1){ fclose(f); die("read pedido"); }
-    printf("Pedido %lld — n_itens=%d\n", (long long)ped.id_pedido, ped.n_itens);
-    for(int32_t i=0;i<ped.n_itens;i++){
-        printf("  item%03d -> id_produto=%lld\n", i+1, (long long)ped.ids_produtos[i]);
+    s->ids[s->n_ids++]=id;
+}
+static void sec_saida_fechar(SecSaida* o){
+    sec_saida_entrada(o);
+    if(o->mem){
+        if(!o->mem->dir) o->mem->dir=malloc(sizeof *o->mem->dir);
+        if(!o->mem->ids) o->mem->ids=malloc(sizeof *o->mem->ids);
+        if(!o->mem->dir || !o->mem->ids) die("malloc indice secundario");
+        return;
     }
-    fclose(f);
+    unsigned char buf[65536]; size_t r; int ok=1;
+    rewind(o->ids);
+    while(ok && (r=fread(buf,1,sizeof buf,o->ids))>0) ok=fwrite(buf,1,r,o->f)==r;
+    fclose(o->ids);
+    ok=ok && fseek(o->f,0,SEEK_SET)==0 && fwrite(&o->cab,sizeof o->cab,1,o->f)==1;
+    if(fclose(o->f)!=0 || !ok){ remove(o->tmp); die(o->tmp); }
+    if(rename(o->tmp,o->path)!=0){ remove(o->tmp); die(o->path); }
 }
 
-static void cmd_list_prod_n(long n){
-    if(n<=0){ printf("N inválido.\n"); return; }
-    FILE* f=fopen(PATH_JOIAS,"rb"); if(!f){ printf("Não foi possível abrir %s\n", PATH_JOIAS); return; }
-    Produto p; long i=0; printf("Primeiros %ld produtos:\n", n);
-    while(i<n && fread(&p,sizeof p,1,f)==1){
-        printf("%3ld) id=%lld nome=\"%.*s\" cat=\"%.*s\" marca=\"%.*s\" preco=%.2f\n",
-               i+1,(long long)p.id_produto,(int)NOME_MAX,p.nome,(int)CAT_MAX,p.categoria,(int)MARCA_MAX,p.marca,p.preco);
-        i++;
+static void sec_montar_nome(SecColetor* c, SecSaida* o){
+    if(!c->runs.n){
+        qsort(c->nomes,c->n_nomes,sizeof *c->nomes,cmp_sec_par);
+        for(size_t i=0;i<c->n_nomes;i++) sec_saida_par(o,c->nomes[i].chave,c->nomes[i].id);
+    }else{
+        if(c->n_nomes) sec_despejar(c);
+        free(c->nomes); c->nomes=NULL; c->cap_nomes=0;
+        MergeRuns m; SecPar par;
+        merge_abrir(&m,c->runs.v,c->runs.n,sizeof par,cmp_sec_par);
+        while(merge_prox(&m,&par)) sec_saida_par(o,par.chave,par.id);
+        merge_fechar(&m);
     }
-    if(i==0) printf("(arquivo vazio)\n");
-    fclose(f);
+    free(c->nomes); free(c->runs.v);
+    c->nomes=NULL; c->n_nomes=c->cap_nomes=0;
+    memset(&c->runs,0,sizeof c->runs);
 }
-static void cmd_list_pedidos_n(long n){
-    if(n<=0){ printf("N inválido.\n"); return; }
-    FILE* f=fopen(PATH_PEDIDOS,"rb"); if(!f){ printf("Não foi possível abrir %s\n", PATH_PEDIDOS); return; }
-    long printed=0;
-    while(printed<n){
-        Pedido ped; size_t rd=fread(&ped,sizeof ped,1,f);
-        if(rd!=1) break;
-        printf("%3ld) id_pedido=%lld  n_itens=%d\n", printed+1, (long long)ped.id_pedido, ped.n_itens);
-        printed++;
-    }
-    if(printed==0) printf("(arquivo vazio)\n");
-    fclose(f);
+static int cmp_dic_valor(const void* a, const void* b){
+    return strncmp(*(const char* const*)a,*(const char* const*)b,DIC_VALOR);
 }
-
-static void cmd_add_produto(const char* s_cat, const char* s_marca, const char* s_nome, const char* s_preco){
-    double preco;
-    if(!try_f64(s_preco,&preco)){
-        fprintf(stderr,"preco inválido.\n"); return;
+static void sec_montar_cat_runs(SecColetor* c, SecSaida* o, const char** ordem, size_t nv){
+    if(c->n_cods) sec_despejar(c);
+    free(c->cods); c->cods=NULL; c->cap_cods=0;
+    uint64_t* ini=calloc(nv? nv:1,sizeof *ini); uint64_t* qtd=calloc(nv? nv:1,sizeof *qtd);
+    FILE* f=tmpfile();
+    if(!ini || !qtd) die("calloc indice secundario");
+    if(!f) die("tmpfile indice secundario");
+    MergeRuns m; SecCod par; uint64_t n=0;
+    merge_abrir(&m,c->runs_cods.v,c->runs_cods.n,sizeof par,cmp_sec_cod);
+    while(merge_prox(&m,&par)){
+        if(!qtd[par.cod]) ini[par.cod]=n;
+        qtd[par.cod]++; n++;
+        if(fwrite(&par,sizeof par,1,f)!=1) die("w indice secundario");
     }
-    if(!s_cat||!s_nome){ fprintf(stderr,"categoria e nome são obrigatórios.\n"); return; }
-    
-    int64_t id_produto = 1;
-    FILE* fin = fopen(PATH_JOIAS, "rb");
-    
-    if(fin){
-        Produto p;
-        while(fread(&p, sizeof p, 1, fin)==1){
-            if(p.id_produto >= id_produto){
-                id_produto = p.id_produto + 1;
-            }
+    merge_fechar(&m);
+    free(c->runs_cods.v); memset(&c->runs_cods,0,sizeof c->runs_cods);
+    char chave[NOME_MAX];
+    for(size_t i=0;i<nv;i++){
+        size_t cod=(size_t)(ordem[i]-c->cats.v[0])/DIC_VALOR;
+        if(!qtd[cod]) continue;
+        memset(chave,0,sizeof chave); strncpy(chave,ordem[i],DIC_VALOR);
+        if(fseek(f,(long)(ini[cod]*sizeof par),SEEK_SET)!=0) die("seek indice secundario");
+        for(uint64_t k=0;k<qtd[cod];k++){
+            if(fread(&par,sizeof par,1,f)!=1) die("r indice secundario");
+            sec_saida_par(o,chave,par.id);
         }
-        fclose(fin);
-        fin = fopen(PATH_JOIAS, "rb");
     }
-    
-    Produto novo;
-    memset(&novo, 0, sizeof(Produto));
-    novo.id_produto = id_produto;
-    safe_copy(novo.categoria, CAT_MAX, s_cat);
-    safe_copy(novo.marca, MARCA_MAX, s_marca?s_marca:"");
-    safe_copy(novo.nome, NOME_MAX, s_nome);
-    novo.preco = preco;
-    
-    FILE* fout = fopen("joias.tmp", "wb");
-    if(!fout) die("joias.tmp");
-    
-    int inserted = 0;
-    if(!fin){
-        if(fwrite(&novo, sizeof(Produto), 1, fout)!=1){ fclose(fout); die("w novo produto"); }
-        inserted = 1;
-    } else {
-        Produto p;
-        while(fread(&p, sizeof p, 1, fin)==1){
-            if(!inserted && id_produto < p.id_produto){
-                if(fwrite(&novo, sizeof(Produto), 1, fout)!=1){ fclose(fin); fclose(fout); die("w novo"); }
-                inserted = 1;
-            }
-            if(fwrite(&p, sizeof(Produto), 1, fout)!=1){ fclose(fin); fclose(fout); die("w produto"); }
-        }
-        if(!inserted){
-            if(fwrite(&novo, sizeof(Produto), 1, fout)!=1){ fclose(fout); die("w novo fim"); }
-        }
-        fclose(fin);
+    fclose(f); free(ini); free(qtd);
+}
+static void sec_montar_cat(SecColetor* c, SecSaida* o){
+    size_t nv=c->cats.n;
+    const char** ordem=malloc((nv? nv:1)*sizeof *ordem); uint32_t* pos=malloc((nv? nv:1)*sizeof *pos);
+    if(!ordem || !pos) die("malloc indice secundario");
+    for(size_t i=0;i<nv;i++) ordem[i]=c->cats.v[i];
+    qsort(ordem,nv,sizeof *ordem,cmp_dic_valor);
+    if(c->runs_cods.n){
+        sec_montar_cat_runs(c,o,ordem,nv);
+        free(ordem); free(pos);
+        dic_liberar(&c->cats);
+        return;
     }
-    fclose(fout);
-    
-    if(remove(PATH_JOIAS)!=0 && errno!=ENOENT) die("rm joias.dat");
-    if(rename("joias.tmp", PATH_JOIAS)!=0) die("mv joias.tmp");
-    
-    build_joias_idx();
-    printf("Produto %lld adicionado com sucesso.\n", (long long)id_produto);
+    for(size_t i=0;i<nv;i++) pos[(size_t)(ordem[i]-c->cats.v[0])/DIC_VALOR]=(uint32_t)i;
+    for(size_t i=0;i<c->n_cods;i++) c->cods[i].cod=pos[c->cods[i].cod];
+    qsort(c->cods,c->n_cods,sizeof *c->cods,cmp_sec_cod);
+    char chave[NOME_MAX]; memset(chave,0,sizeof chave);
+    for(size_t i=0;i<c->n_cods;i++){
+        if(!i || c->cods[i].cod!=c->cods[i-1].cod) strncpy(chave,ordem[c->cods[i].cod],DIC_VALOR);
+        sec_saida_par(o,chave,c->cods[i].id);
+    }
+    free(ordem); free(pos); free(c->cods);
+    c->cods=NULL; c->n_cods=c->cap_cods=0;
+    dic_liberar(&c->cats);
 }
-
-static void cmd_remove_produto(const char* s_id){
-    int64_t id_produto;
-    if(!try_i64(s_id,&id_produto)){ fprintf(stderr,"id_produto inválido.\n"); return; }
-    
-    FILE* fin = fopen(PATH_JOIAS, "rb");
-    if(!fin){ printf("Arquivo joias.dat não existe.\n"); return; }
-    
-    FILE* fout = fopen("joias.tmp", "wb");
-    if(!fout){ fclose(fin); die("joias.tmp"); }
-    
-    Produto p;
-    int found = 0;
-    while(fread(&p, sizeof p, 1, fin)==1){
-        if(p.id_produto == id_produto){
-            found = 1;
-            continue;
-        }
-        if(fwrite(&p, sizeof(Produto), 1, fout)!=1){ fclose(fin); fclose(fout); die("w produto"); }
+static void sec_montar(SecColetor* c, int campo, SecSaida* o){
+    if(campo==SEC_NOME) sec_montar_nome(c,o);
+    else sec_montar_cat(c,o);
+    sec_saida_fechar(o);
+}
+static void sec_coletor_liberar(SecColetor* c){
+    for(size_t i=0;i<c->runs.n;i++) fclose(c->runs.v[i]);
+    for(size_t i=0;i<c->runs_cods.n;i++) fclose(c->runs_cods.v[i]);
+    free(c->nomes); free(c->runs.v); free(c->cods); free(c->runs_cods.v);
+    dic_liberar(&c->cats);
+    memset(c,0,sizeof *c);
+}
+static void sec_salvar(const SecIdx* s, int campo, uint64_t checksum){
+    SecCab cab; memset(&cab,0,sizeof cab);
+    memcpy(cab.magic,SECIDX_MAGIC,sizeof cab.magic);
+    cab.checksum=checksum; cab.n_chaves=s->n_chaves; cab.n_ids=s->n_ids;
+    ParteArq partes[]={ {&cab,sizeof cab,1}, {s->dir,sizeof *s->dir,s->n_chaves}, {s->ids,sizeof *s->ids,s->n_ids} };
+    gravar_atomico(sec_path(campo),partes,3);
+}
+static void sec_gravar(SecColetor* c, uint64_t checksum){
+    for(int campo=SEC_NOME; campo<=SEC_CAT; campo++){
+        SecSaida o;
+        sec_saida_abrir(&o,campo,checksum,NULL);
+        sec_montar(c,campo,&o);
     }
-    fclose(fin);
-    fclose(fout);
-    
-    if(!found){
-        printf("Produto %lld não encontrado.\n", (long long)id_produto);
-        remove("joias.tmp");
+}
+
+static void zona_registrar(Zonas* z, uint64_t rec, size_t passo, double preco){
+    size_t b=(size_t)(rec/passo);
+    if(b<z->n){
+        if(preco<z->v[b].min) z->v[b].min=preco;
+        if(preco>z->v[b].max) z->v[b].max=preco;
         return;
     }
+    if(z->n==z->cap){
+        z->cap=z->cap? z->cap*2 : 256;
+        z->v=realloc(z->v,z->cap*sizeof *z->v); if(!z->v) die("realloc zonas");
+    }
+    z->v[z->n].min=z->v[z->n].max=preco;
+    z->n++;
+}
+static void zona_liberar(Zonas* z){
+    free(z->v);
+    memset(z,0,sizeof *z);
+}
+static void zona_salvar(const Zonas* z, uint64_t checksum){
+    ZonaCab cab; memset(&cab,0,sizeof cab);
+    memcpy(cab.magic,ZONA_MAGIC,sizeof cab.magic);
+    cab.checksum=checksum; cab.n_blocos=z->n;
+    ParteArq partes[]={ {&cab,sizeof cab,1}, {z->v,sizeof *z->v,z->n} };
+    gravar_atomico(PATH_JOIAS_ZONA,partes,2);
+}
+static void zona_gravar(Zonas* z, uint64_t checksum){
+    zona_salvar(z,checksum);
+    zona_liberar(z);
+}
+static int zona_carregar(Zonas* z, uint64_t checksum){
+    char path[GER_CAMINHO];
+    FILE* f=fopen(ger_arq(path,PATH_JOIAS_ZONA),"rb"); if(!f) return 0;
+    ZonaCab cab;
+    int ok=fread(&cab,sizeof cab,1,f)==1 && memcmp(cab.magic,ZONA_MAGIC,sizeof cab.magic)==0 && cab.checksum==checksum;
+    if(ok){
+        z->n=z->cap=(size_t)cab.n_blocos;
+        z->v=malloc((z->n? z->n:1)*sizeof *z->v); if(!z->v) die("malloc zonas");
+        ok=fread(z->v,sizeof *z->v,z->n,f)==z->n;
+        if(!ok) zona_liberar(z);
+    }
+    fclose(f);
+    return ok;
+}
+
+enum { CONFLITO_PRECO=1, CONFLITO_TEXTO=2 };
+
+typedef struct {
+    FILE* f;
+    FILE* idx;
+    TabelaMeta m;
+    int64_t ultimo;
+    SecColetor sec;
+    Zonas zonas;
+    Dicionario dic[2];
+    LayoutJoias l;
+    uint32_t paginas;
+    ProdutoCod ant;
+    DupProd* dup;
+} EscritorJoias;
+
+static void dup_registrar(DupProd* d, ProdutoTmp* a, const ProdutoTmp* b){
+    d->repetidos++;
+    if(strcmp(a->categoria,b->categoria)!=0 || strcmp(a->marca,b->marca)!=0 || strcmp(a->nome,b->nome)!=0) a->conflito|=CONFLITO_TEXTO;
+    if(a->preco!=b->preco) a->conflito|=CONFLITO_PRECO;
+    a->conflito|=b->conflito;
+    if(b->preco_min<a->preco_min) a->preco_min=b->preco_min;
+    if(b->preco_max>a->preco_max) a->preco_max=b->preco_max;
+}
+static void dup_somar(DupProd* d, const DupProd* o){
+    d->repetidos+=o->repetidos;
+}
+static void dup_conflito(DupProd* d, const ProdutoTmp* p){
+    if(!p->conflito) return;
+    d->conflitos++;
+    if(d->nex<IMPORT_EXEMPLOS){
+        ConflitoProd* c=&d->ex[d->nex++];
+        c->id=p->id_produto; c->preco=p->preco; c->preco_min=p->preco_min; c->preco_max=p->preco_max;
+        c->texto=(p->conflito&CONFLITO_TEXTO)!=0;
+    }
+}
+static void dup_relatorio(const DupProd* d, size_t distintos){
+    printf("Produtos: %zu distintos, %zu linhas repetidas, %zu conflitantes\n", distintos, d->repetidos, d->conflitos);
+    for(size_t i=0;i<d->nex;i++){
+        printf("  conflito: produto %lld preco %.2f", (long long)d->ex[i].id, d->ex[i].preco);
+        if(d->ex[i].preco_min!=d->ex[i].preco_max)
+            printf(" (preços de %.2f a %.2f nas linhas repetidas)", d->ex[i].preco_min, d->ex[i].preco_max);
+        printf("%s\n", d->ex[i].texto? " (categoria/marca/nome diferentes)" : "");
+    }
+}
+
+static int escritor_joias_gravar(EscritorJoias* e, const ProdutoTmp* v){
+    if(e->f && v->id_produto==e->ultimo) return 1;
+    if(!e->f){
+        char path[GER_CAMINHO];
+        e->f=fopen(ger_arq(path,PATH_JOIAS),"w+b"); if(!e->f) die("joias.dat");
+        e->idx=fopen(ger_arq(path,PATH_JOIAS_IDX),"wb"); if(!e->idx) die("joias.idx");
+        joias_layout(&e->l,e->paginas? JOIAS_FMT_PAG : JOIAS_FMT_CMP,e->paginas);
+        meta_iniciar(&e->m,(uint32_t)e->l.fmt);
+        joias_cabecalho(e->f,&e->l,&e->m.checksum);
+    }
+    Produto p;
+    memset(&p,0,sizeof p);
+    p.id_produto=v->id_produto;
+    safe_copy(p.categoria,CAT_MAX,v->categoria);
+    safe_copy(p.marca,MARCA_MAX,v->marca);
+    safe_copy(p.nome,NOME_MAX,v->nome);
+    p.preco=v->preco;
+    joias_idx_amostrar(e->idx,&e->l,e->m.n_registros,p.id_produto,e->f);
+    int r=joias_escrever(e->f,&e->l,e->m.n_registros,e->dic,&p,&e->ant,&e->m.checksum);
+    if(r==JOIAS_DIC_CHEIO) return 0;
+    if(!r) die("w joias");
+    zona_registrar(&e->zonas,e->m.n_registros,e->l.passo,p.preco);
+    meta_registro(&e->m,p.id_produto);
+    sec_coletar(&e->sec,&p);
+    if(e->dup) dup_conflito(e->dup,v);
+    e->ultimo=p.id_produto;
+    return 1;
+}
+static void escritor_joias_descartar(EscritorJoias* e){
+    if(e->f){ fclose(e->f); fclose(e->idx); }
+    sec_coletor_liberar(&e->sec);
+    zona_liberar(&e->zonas);
+    dic_liberar(&e->dic[DIC_CAT]); dic_liberar(&e->dic[DIC_MARCA]);
+    e->f=NULL;
+}
+static void escritor_joias_fechar(EscritorJoias* e){
+    if(!e->f) return;
+    if(e->dup) dup_relatorio(e->dup,(size_t)e->m.n_registros);
+    meta_gravar(PATH_JOIAS_META,&e->m,e->f);
+    sec_gravar(&e->sec,e->m.checksum);
+    zona_gravar(&e->zonas,e->m.checksum);
+    dic_gravar(&e->dic[DIC_CAT],DIC_CAT); dic_gravar(&e->dic[DIC_MARCA],DIC_MARCA);
+    dic_liberar(&e->dic[DIC_CAT]); dic_liberar(&e->dic[DIC_MARCA]);
+    if(fclose(e->f)!=0) die("w joias.dat");
+    if(fclose(e->idx)!=0) die("w joias.idx");
+    printf("joias.dat: %llu produtos únicos\n", (unsigned long long)e->m.n_registros);
+    if(e->l.fmt==JOIAS_FMT_CMP) printf("joias.idx: ok (step=%zu, blocos comprimidos)\n", e->l.passo);
+    else printf("joias.idx: ok (step=%zu, blocos de %u páginas)\n", e->l.passo, e->l.paginas);
+}
+
+static void vendas_consolidar(Vendas* a){
+    size_t n=a->npend;
+    if(!n) return;
+    ChaveIdx* ord=malloc(n*sizeof *ord); ChaveIdx* tmp=malloc(n*sizeof *tmp);
+    VendaProd* v=malloc((a->n+n)*sizeof *v);
+    if(!ord || !tmp || !v) die("malloc vendas");
+    for(size_t i=0;i<n;i++){ ord[i].chave=chave_radix(a->pend[i].id_produto); ord[i].idx=i; }
+    radix_ordenar(ord,tmp,n);
+    size_t i=0, j=0, k=0;
+    while(i<a->n || j<n){
+        VendaProd x;
+        if(j==n || (i<a->n && a->v[i].id_produto<=a->pend[ord[j].idx].id_produto)) x=a->v[i++];
+        else x=a->pend[ord[j++].idx];
+        if(k && v[k-1].id_produto==x.id_produto) v[k-1].unidades+=x.unidades;
+        else v[k++]=x;
+    }
+    size_t m=0;
+    for(size_t t=0;t<k;t++) if(v[t].unidades) v[m++]=v[t];
+    free(ord); free(tmp); free(a->v);
+    a->v=v; a->n=m; a->npend=0;
+}
+static void vendas_somar(Vendas* a, int64_t id, int64_t unidades){
+    if(!unidades) return;
+    if(!a->pend){ a->pend=malloc(VENDAS_LOTE*sizeof *a->pend); if(!a->pend) die("malloc vendas"); }
+    if(a->npend==VENDAS_LOTE) vendas_consolidar(a);
+    a->pend[a->npend].id_produto=id; a->pend[a->npend].unidades=unidades;
+    a->npend++;
+}
+static int64_t vendas_unidades(const Vendas* a, int64_t id){
+    size_t lo=0, hi=a->n;
+    while(lo<hi){
+        size_t mid=(lo+hi)/2;
+        if(a->v[mid].id_produto<id) lo=mid+1; else hi=mid;
+    }
+    return (lo<a->n && a->v[lo].id_produto==id)? a->v[lo].unidades : 0;
+}
+static void vendas_liberar(Vendas* a){
+    free(a->v); free(a->pend);
+    memset(a,0,sizeof *a);
+}
+static void vendas_gravar(const Vendas* a, uint64_t checksum){
+    VendasCab cab; memset(&cab,0,sizeof cab);
+    memcpy(cab.magic,VENDAS_MAGIC,sizeof cab.magic);
+    cab.checksum=checksum; cab.n=a->n;
+    ParteArq partes[]={ {&cab,sizeof cab,1}, {a->v,sizeof *a->v,a->n} };
+    gravar_atomico(PATH_VENDAS_AGG,partes,2);
+}
+static int vendas_ler(Vendas* a, VendasCab* cab){
+    memset(a,0,sizeof *a);
+    char path[GER_CAMINHO];
+    FILE* f=fopen(ger_arq(path,PATH_VENDAS_AGG),"rb"); if(!f) return 0;
+    int ok=fread(cab,sizeof *cab,1,f)==1 && memcmp(cab->magic,VENDAS_MAGIC,sizeof cab->magic)==0;
+    if(ok){
+        a->n=(size_t)cab->n;
+        a->v=malloc((a->n? a->n:1)*sizeof *a->v); if(!a->v) die("malloc vendas");
+        ok=fread(a->v,sizeof *a->v,a->n,f)==a->n;
+        if(!ok) vendas_liberar(a);
+    }
+    fclose(f);
+    return ok;
+}
+static uint64_t tam_arquivo(const char* path){
+    struct stat sb;
+    return stat(path,&sb)==0? (uint64_t)sb.st_size : 0;
+}
+
+typedef struct {
+    FILE* f;
+    FILE* idx;
+    TabelaMeta m;
+    PedidoVar ped;
+    int64_t total;
+    size_t passo;
+    Vendas vendas;
+} EscritorPedidos;
+
+static void escritor_pedidos_flush(EscritorPedidos* e){
+    if(!e->f) return;
+    if(e->total > INT32_MAX) fprintf(stderr, "Pedido %lld tem %lld itens. Truncando.\n", (long long)e->ped.id_pedido, (long long)e->total);
+    pidx_amostrar(e->idx, e->passo, e->m.n_registros, e->ped.id_pedido, (uint64_t)ftell(e->f));
+    if(!ped_escrever(e->f, PED_FMT_VAR, e->ped.id_pedido, e->ped.n_itens, e->ped.ids_produtos, &e->m.checksum)) die("w pedido");
+    meta_registro(&e->m, e->ped.id_pedido);
+}
+static void escritor_pedidos_linha(EscritorPedidos* e, const LinhaTmp* l){
+    if(!e->f){
+        char path[GER_CAMINHO];
+        e->f = fopen(ger_arq(path, PATH_PEDIDOS), "w+b"); if(!e->f) die("pedidos.dat");
+        e->idx = fopen(ger_arq(path, PATH_PEDIDOS_IDX), "wb"); if(!e->idx) die("pedidos.idx");
+        pidx_cabecalho(e->idx, e->passo);
+        meta_iniciar(&e->m,PED_FMT_VAR);
+        ped_cabecalho(e->f, PED_FMT_VAR, &e->m.checksum);
+        memset(&e->ped, 0, sizeof e->ped);
+        e->ped.id_pedido = l->id_pedido;
+        e->total = 0;
+    }else if(l->id_pedido != e->ped.id_pedido){
+        escritor_pedidos_flush(e);
+        e->ped.id_pedido = l->id_pedido; e->ped.n_itens = 0;
+        e->total = 0;
+    }
+    if(l->quantidade<=0) return;
+    e->total += l->quantidade;
+    int32_t q = l->quantidade;
+    if(q > INT32_MAX - e->ped.n_itens) q = INT32_MAX - e->ped.n_itens;
+    pedvar_reservar(&e->ped, (size_t)e->ped.n_itens + (size_t)q);
+    for(int32_t k=0; k<q; k++) e->ped.ids_produtos[e->ped.n_itens++] = l->id_produto;
+    vendas_somar(&e->vendas, l->id_produto, q);
+}
+static void escritor_pedidos_fechar(EscritorPedidos* e){
+    if(!e->f) return;
+    escritor_pedidos_flush(e);
+    pedvar_free(&e->ped);
+    meta_gravar(PATH_PEDIDOS_META,&e->m,e->f);
+    if(fclose(e->f)!=0) die("w pedidos.dat");
+    if(fclose(e->idx)!=0) die("w pedidos.idx");
+    vendas_consolidar(&e->vendas);
+    vendas_gravar(&e->vendas, e->m.checksum);
+    printf("pedidos.dat: gravado e indexado (step=%zu).\n", e->passo);
+    printf("%s: %zu produtos com vendas.\n", PATH_VENDAS_AGG, e->vendas.n);
+    vendas_liberar(&e->vendas);
+}
+
+static int write_joias(ProdutoTmp* v, size_t n, uint32_t paginas, DupProd* dup){
+    if(!n) return 1;
+    ChaveIdx* ord=ordenar_produtos(v,n);
+    EscritorJoias e; memset(&e,0,sizeof e);
+    e.paginas=paginas; e.dup=dup;
+    int ok=1;
+    for(size_t i=0;i<n && ok;i++) ok=escritor_joias_gravar(&e,&v[ord[i].idx]);
+    if(ok) escritor_joias_fechar(&e);
+    else escritor_joias_descartar(&e);
+    free(ord);
+    return ok;
+}
+
+static void write_pedidos_and_index(LinhaTmp* v, size_t n, size_t passo){
+    if(!n) return;
+    ChaveIdx* ord=ordenar_linhas(v,n);
+    EscritorPedidos e; memset(&e,0,sizeof e);
+    e.passo=passo;
+    for(size_t i=0;i<n;i++) escritor_pedidos_linha(&e,&v[ord[i].idx]);
+    escritor_pedidos_fechar(&e);
+    free(ord);
+}
+
+static size_t pool_slot(int arq, uint64_t bloco){
+    return (size_t)(hash_id((int64_t)(bloco*2+(uint64_t)arq)) % POOL_NHASH);
+}
+static void pool_desligar(BufPool* bp, Quadro* q){
+    if(q->ant) q->ant->prox=q->prox; else bp->mru=q->prox;
+    if(q->prox) q->prox->ant=q->ant; else bp->lru=q->ant;
+    q->ant=q->prox=NULL;
+}
+static void pool_ligar_mru(BufPool* bp, Quadro* q){
+    q->ant=NULL; q->prox=bp->mru;
+    if(bp->mru) bp->mru->ant=q;
+    bp->mru=q;
+    if(!bp->lru) bp->lru=q;
+}
+static void pool_descartar(BufPool* bp, Quadro* q){
+    Quadro** pp=&bp->hash[pool_slot(q->arq,q->bloco)];
+    while(*pp!=q) pp=&(*pp)->hprox;
+    *pp=q->hprox;
+    pool_desligar(bp,q);
+    bp->bytes-=q->len; bp->nquadros--;
+    free(q->dados); free(q);
+}
+static void pool_invalidar(BufPool* bp, int arq, uint64_t a_partir){
+    Quadro* q=bp->mru;
+    while(q){
+        Quadro* nx=q->prox;
+        if(q->arq==arq && q->bloco>=a_partir) pool_descartar(bp,q);
+        q=nx;
+    }
+}
+static void pool_init(BufPool* bp, size_t cap_bytes){
+    memset(bp,0,sizeof *bp);
+    bp->cap_bytes=cap_bytes;
+}
+static void pool_free(BufPool* bp){
+    while(bp->lru) pool_descartar(bp,bp->lru);
+}
+static const unsigned char* pool_buscar(BufPool* bp, int arq, uint64_t bloco, size_t* len){
+    for(Quadro* q=bp->hash[pool_slot(arq,bloco)]; q; q=q->hprox){
+        if(q->arq==arq && q->bloco==bloco){
+            bp->hits++;
+            if(bp->mru!=q){ pool_desligar(bp,q); pool_ligar_mru(bp,q); }
+            *len=q->len; return q->dados;
+        }
+    }
+    bp->misses++;
+    return NULL;
+}
+static const unsigned char* pool_guardar(BufPool* bp, int arq, uint64_t bloco, unsigned char* buf, size_t len){
+    size_t h=pool_slot(arq,bloco);
+    while(bp->lru && bp->bytes+len>bp->cap_bytes) pool_descartar(bp,bp->lru);
+    Quadro* q=calloc(1,sizeof *q); if(!q) die("malloc quadro");
+    q->arq=arq; q->bloco=bloco; q->dados=buf; q->len=len;
+    q->hprox=bp->hash[h]; bp->hash[h]=q;
+    pool_ligar_mru(bp,q);
+    bp->bytes+=len; bp->nquadros++;
+    return buf;
+}
+static const unsigned char* pool_bloco(BufPool* bp, FILE* f, int arq, uint64_t ini, uint64_t bloco, size_t tam_bloco, size_t* len){
+    const unsigned char* v=pool_buscar(bp,arq,bloco,len);
+    if(v || !f) return v;
+    unsigned char* buf=malloc(tam_bloco); if(!buf) die("malloc quadro");
+    if(fseek(f,(long)(ini+bloco*tam_bloco),SEEK_SET)!=0) die("seek bloco");
+    size_t rd=fread(buf,1,tam_bloco,f);
+    if(rd==0){ free(buf); return NULL; }
+    *len=rd;
+    return pool_guardar(bp,arq,bloco,buf,rd);
+}
+
+static void mapa_abrir(Mapa* m, FILE* f){
+    m->base=NULL; m->len=0;
+    if(!f) return;
+    struct stat sb;
+    if(fstat(fileno(f),&sb)!=0 || sb.st_size<=0) return;
+    void* p=mmap(NULL,(size_t)sb.st_size,PROT_READ,MAP_PRIVATE,fileno(f),0);
+    if(p==MAP_FAILED) return;
+    m->base=p; m->len=(size_t)sb.st_size;
+    madvise(m->base,m->len,MADV_RANDOM);
+}
+static void mapa_fechar(Mapa* m){
+    if(m->base) munmap(m->base,m->len);
+    m->base=NULL; m->len=0;
+}
+
+static size_t delta_joias_pos(const DeltaJoias* d, int64_t id){
+    size_t lo=0, hi=d->n;
+    while(lo<hi){
+        size_t mid=(lo+hi)/2;
+        if(d->v[mid].p.id_produto<id) lo=mid+1; else hi=mid;
+    }
+    return lo;
+}
+static const DeltaProd* delta_joias_buscar(const DeltaJoias* d, int64_t id){
+    size_t i=delta_joias_pos(d,id);
+    return (i<d->n && d->v[i].p.id_produto==id)? &d->v[i] : NULL;
+}
+static void delta_joias_aplicar(DeltaJoias* d, int32_t op, const Produto* p, uint16_t cod_categoria){
+    size_t i=delta_joias_pos(d,p->id_produto);
+    if(i<d->n && d->v[i].p.id_produto==p->id_produto){
+        d->v[i].op=op; d->v[i].cod_categoria=cod_categoria; d->v[i].p=*p;
+        return;
+    }
+    if(d->n==d->cap){
+        d->cap=d->cap? d->cap*2 : 64;
+        d->v=realloc(d->v,d->cap*sizeof *d->v); if(!d->v) die("realloc delta joias");
+    }
+    memmove(&d->v[i+1],&d->v[i],(d->n-i)*sizeof *d->v);
+    d->v[i].op=op; d->v[i].cod_categoria=cod_categoria; d->v[i].p=*p;
+    d->n++;
+}
+static size_t delta_pedidos_pos(const DeltaPedidos* d, int64_t id){
+    size_t lo=0, hi=d->n;
+    while(lo<hi){
+        size_t mid=(lo+hi)/2;
+        if(d->v[mid].p.id_pedido<id) lo=mid+1; else hi=mid;
+    }
+    return lo;
+}
+static const DeltaPed* delta_pedidos_buscar(const DeltaPedidos* d, int64_t id){
+    size_t i=delta_pedidos_pos(d,id);
+    return (i<d->n && d->v[i].p.id_pedido==id)? &d->v[i] : NULL;
+}
+static void delta_pedidos_aplicar(DeltaPedidos* d, int32_t op, int64_t id, int32_t n, const int64_t* ids){
+    size_t i=delta_pedidos_pos(d,id);
+    if(!(i<d->n && d->v[i].p.id_pedido==id)){
+        if(d->n==d->cap){
+            d->cap=d->cap? d->cap*2 : 64;
+            d->v=realloc(d->v,d->cap*sizeof *d->v); if(!d->v) die("realloc delta pedidos");
+        }
+        memmove(&d->v[i+1],&d->v[i],(d->n-i)*sizeof *d->v);
+        memset(&d->v[i],0,sizeof d->v[i]);
+        d->n++;
+    }
+    DeltaPed* e=&d->v[i];
+    e->op=op; e->p.id_pedido=id; e->p.n_itens=n;
+    pedvar_reservar(&e->p,(size_t)n);
+    if(n) memcpy(e->p.ids_produtos,ids,(size_t)n*sizeof *ids);
+}
+static void delta_joias_limpar(DeltaJoias* d){
+    if(d->log){ fclose(d->log); d->log=NULL; }
+    free(d->v);
+    memset(d,0,sizeof *d);
+}
+static void delta_pedidos_limpar(DeltaPedidos* d){
+    if(d->log){ fclose(d->log); d->log=NULL; }
+    for(size_t i=0;i<d->n;i++) pedvar_free(&d->v[i].p);
+    free(d->v);
+    memset(d,0,sizeof *d);
+}
+static int buscar_pedido(Store* st, int64_t target, PedidoVar* ped);
+static void vendas_somar_pedido(Vendas* a, const PedidoVar* ped, int64_t sinal);
+static void delta_carregar(Store* st, Vendas* vendas){
+    char path[GER_CAMINHO];
+    FILE* f=fopen(ger_arq(path,PATH_JOIAS_DELTA),"rb");
+    if(f){
+        int32_t op; Produto p;
+        if(fseek(f,(long)st->dj.tam,SEEK_SET)!=0) die("seek joias.delta");
+        while(fread(&op,sizeof op,1,f)==1 && fread(&p,sizeof p,1,f)==1){
+            delta_joias_aplicar(&st->dj,op,&p,dic_buscar(&st->dic[DIC_CAT],p.categoria));
+            st->dj.nlog++;
+            st->dj.tam=(uint64_t)ftell(f);
+        }
+        fclose(f);
+    }
+    f=fopen(ger_arq(path,PATH_PEDIDOS_DELTA),"rb");
+    if(f){
+        int32_t op; PedidoVar ped, ant; memset(&ped,0,sizeof ped); memset(&ant,0,sizeof ant);
+        if(fseek(f,(long)st->dp.tam,SEEK_SET)!=0) die("seek pedidos.delta");
+        while(fread(&op,sizeof op,1,f)==1 && ped_ler(f,PED_FMT_VAR,&ped)){
+            if(vendas){
+                if(buscar_pedido(st,ped.id_pedido,&ant)) vendas_somar_pedido(vendas,&ant,-1);
+                if(op==DELTA_INS) vendas_somar_pedido(vendas,&ped,1);
+            }
+            delta_pedidos_aplicar(&st->dp,op,ped.id_pedido,ped.n_itens,ped.ids_produtos);
+            st->dp.nlog++;
+            st->dp.tam=(uint64_t)ftell(f);
+        }
+        pedvar_free(&ped); pedvar_free(&ant);
+        fclose(f);
+    }
+}
+static FILE* delta_log(const char* nome, uint64_t tam){
+    char path[GER_CAMINHO]; ger_arq(path,nome);
+    if(truncate(path,(off_t)tam)!=0 && errno!=ENOENT) die(path);
+    FILE* f=fopen(path,"ab"); if(!f) die(path);
+    return f;
+}
+static void delta_registrar_produto(Store* st, int32_t op, const Produto* p){
+    DeltaJoias* d=&st->dj;
+    if(!d->log) d->log=delta_log(PATH_JOIAS_DELTA,d->tam);
+    if(fwrite(&op,sizeof op,1,d->log)!=1 || fwrite(p,sizeof *p,1,d->log)!=1) die("w joias.delta");
+    delta_joias_aplicar(d,op,p,dic_buscar(&st->dic[DIC_CAT],p->categoria));
+    d->nlog++;
+    d->tam+=sizeof op+sizeof *p;
+}
+static void delta_registrar_pedido(Store* st, int32_t op, int64_t id, int32_t n, const int64_t* ids){
+    DeltaPedidos* d=&st->dp;
+    if(!d->log) d->log=delta_log(PATH_PEDIDOS_DELTA,d->tam);
+    if(fwrite(&op,sizeof op,1,d->log)!=1 || !ped_escrever(d->log,PED_FMT_VAR,id,n,ids,NULL)) die("w pedidos.delta");
+    delta_pedidos_aplicar(d,op,id,n,ids);
+    d->nlog++;
+    d->tam+=sizeof op+PEDVAR_CAB+(uint64_t)n*sizeof *ids;
+}
+static void delta_sincronizar(Store* st){
+    if(st->dj.log && fflush(st->dj.log)!=0) die("w joias.delta");
+    if(st->dp.log && fflush(st->dp.log)!=0) die("w pedidos.delta");
+}
+static void delta_descartar(Store* st){
+    delta_joias_limpar(&st->dj);
+    delta_pedidos_limpar(&st->dp);
+    char path[GER_CAMINHO];
+    if(remove(ger_arq(path,PATH_JOIAS_DELTA))!=0 && errno!=ENOENT) die("rm joias.delta");
+    if(remove(ger_arq(path,PATH_PEDIDOS_DELTA))!=0 && errno!=ENOENT) die("rm pedidos.delta");
+}
+
+static void sec_liberar(SecIdx* s){
+    free(s->dir); free(s->ids);
+    memset(s,0,sizeof *s);
+}
+static int sec_carregar(SecIdx* s, int campo, uint64_t checksum){
+    char path[GER_CAMINHO];
+    FILE* f=fopen(ger_arq(path,sec_path(campo)),"rb"); if(!f) return 0;
+    SecCab cab;
+    int ok=fread(&cab,sizeof cab,1,f)==1 && memcmp(cab.magic,SECIDX_MAGIC,sizeof cab.magic)==0 && cab.checksum==checksum;
+    if(ok){
+        s->n_chaves=(size_t)cab.n_chaves; s->n_ids=(size_t)cab.n_ids;
+        s->dir=malloc((s->n_chaves? s->n_chaves:1)*sizeof *s->dir);
+        s->ids=malloc((s->n_ids? s->n_ids:1)*sizeof *s->ids);
+        if(!s->dir || !s->ids) die("malloc indice secundario");
+        ok=fread(s->dir,sizeof *s->dir,s->n_chaves,f)==s->n_chaves && fread(s->ids,sizeof *s->ids,s->n_ids,f)==s->n_ids;
+        if(!ok) sec_liberar(s);
+    }
+    fclose(f);
+    return ok;
+}
+static int joias_ler(Store* st, Cursor* c, Produto* p){
+    const void* r=cursor_prox(c);
+    if(!r) return 0;
+    joias_decodificar(st->lj.fmt!=JOIAS_FMT_FIXO? st->dic : NULL, r, p);
+    return 1;
+}
+static void sec_abrir(Store* st){
+    if(st->carregados&DER_SEC) return;
+    st->carregados|=DER_SEC;
+    if(!st->joias) return;
+    if(sec_carregar(&st->sec[SEC_NOME],SEC_NOME,st->meta_joias.checksum) &&
+       sec_carregar(&st->sec[SEC_CAT],SEC_CAT,st->meta_joias.checksum)) return;
+    sec_liberar(&st->sec[SEC_NOME]); sec_liberar(&st->sec[SEC_CAT]);
+    SecColetor sec; memset(&sec,0,sizeof sec);
+    Produto p;
+    Cursor c; cursor_abrir(&c,st->joias,NULL,&st->lj);
+    while(joias_ler(st,&c,&p)) sec_coletar(&sec,&p);
+    cursor_fechar(&c);
+    for(int campo=SEC_NOME; campo<=SEC_CAT; campo++){
+        SecSaida o;
+        sec_saida_abrir(&o,campo,st->meta_joias.checksum,&st->sec[campo]);
+        sec_montar(&sec,campo,&o);
+    }
+    st->derivados|=DER_SEC;
+}
+
+static void zona_abrir(Store* st){
+    if(st->carregados&DER_ZONA) return;
+    st->carregados|=DER_ZONA;
+    if(!st->joias || zona_carregar(&st->zonas,st->meta_joias.checksum)) return;
+    Produto p;
+    Cursor c; cursor_abrir(&c,st->joias,NULL,&st->lj);
+    for(uint64_t rec=0; joias_ler(st,&c,&p); rec++) zona_registrar(&st->zonas,rec,st->lj.passo,p.preco);
+    cursor_fechar(&c);
+    st->derivados|=DER_ZONA;
+}
+
+static size_t eyt_preencher(IndiceMem* ix, size_t i, size_t k){
+    if(k>ix->n) return i;
+    i=eyt_preencher(ix,i,2*k);
+    ix->eyt[k]=ix->chaves[i]; ix->rank[k]=i++;
+    return eyt_preencher(ix,i,2*k+1);
+}
+static void indice_montar(IndiceMem* ix, int modo, int64_t* chaves, uint64_t* offsets, size_t n){
+    ix->chaves=chaves; ix->offsets=offsets; ix->n=n; ix->modo=modo;
+    ix->eyt=NULL; ix->rank=NULL;
+    if(modo!=INDICE_EYTZINGER) return;
+    ix->eyt=malloc((n+1)*sizeof *ix->eyt); ix->rank=malloc((n+1)*sizeof *ix->rank);
+    if(!ix->eyt || !ix->rank) die("malloc eytzinger");
+    eyt_preencher(ix,0,1);
+}
+static void indice_liberar(IndiceMem* ix){
+    free(ix->chaves); free(ix->offsets); free(ix->eyt); free(ix->rank);
+    memset(ix,0,sizeof *ix);
+}
+static size_t indice_lower_bound(const IndiceMem* ix, int64_t x){
+    if(ix->modo==INDICE_EYTZINGER){
+        size_t k=1;
+        while(k<=ix->n){
+            /* os 16 descendentes 4 níveis abaixo (eyt[16k..16k+15]) ocupam 128 bytes: busca as duas linhas de cache */
+            __builtin_prefetch(ix->eyt+16*k);
+            __builtin_prefetch(ix->eyt+16*k+8);
+            k=2*k+(ix->eyt[k]<x);
+        }
+        k>>=__builtin_ffsll((long long)~k);
+        return k? ix->rank[k] : ix->n;
+    }
+    const int64_t* c=ix->chaves;
+    size_t lo=0, hi=ix->n;
+    for(int passo=0; passo<INTERP_PASSOS && lo<hi; passo++){
+        if(x<=c[lo]) return lo;
+        if(x>c[hi-1]) return hi;
+        double f=(double)((uint64_t)x-(uint64_t)c[lo])/(double)((uint64_t)c[hi-1]-(uint64_t)c[lo]);
+        size_t mid=lo+(size_t)(f*(double)(hi-1-lo));
+        if(mid>=hi) mid=hi-1;
+        if(c[mid]<x) lo=mid+1; else hi=mid;
+    }
+    while(lo<hi){
+        size_t mid=(lo+hi)/2;
+        if(c[mid]<x) lo=mid+1; else hi=mid;
+    }
+    return lo;
+}
+static size_t indice_ate(const IndiceMem* ix, int64_t x){
+    return x==INT64_MAX? ix->n : indice_lower_bound(ix,x+1);
+}
+static void indice_joias_montar(IndiceMem* ix, int modo, const JoiasIdxEntry* v, size_t n){
+    int64_t* c=malloc((n? n:1)*sizeof *c); if(!c) die("malloc indice joias");
+    for(size_t i=0;i<n;i++) c[i]=v[i].id_base;
+    indice_montar(ix,modo,c,NULL,n);
+}
+static void indice_pedidos_montar(IndiceMem* ix, int modo, FILE* f, size_t ini, size_t n){
+    int64_t* c=malloc((n? n:1)*sizeof *c); uint64_t* o=malloc((n? n:1)*sizeof *o);
+    PedidosIdxEntry* buf=malloc(PEDIDOS_IDX_PAGINA*sizeof *buf);
+    if(!c || !o || !buf) die("malloc indice pedidos");
+    if(fseek(f,(long)(ini*sizeof *buf),SEEK_SET)!=0) die("seek pedidos.idx");
+    size_t k=0, r;
+    while(k<n && (r=fread(buf,sizeof *buf,PEDIDOS_IDX_PAGINA,f))>0)
+        for(size_t i=0;i<r && k<n;i++,k++){ c[k]=buf[i].id_pedido; o[k]=buf[i].offset; }
+    free(buf);
+    indice_montar(ix,modo,c,o,k);
+}
+
+static void store_carregar_joias(Store* st){
+    st->jidx=NULL; st->n_jidx=0; st->n_joias=0;
+    joias_layout(&st->lj,JOIAS_FMT_FIXO,0);
+    char path[GER_CAMINHO];
+    st->joias=fopen(ger_arq(path,PATH_JOIAS),"rb");
+    if(st->joias) joias_formato(st->joias,&st->lj);
+    st->indisponivel&=~USO_JOIAS;
+    st->derivados&=~(DER_META_JOIAS|DER_SEC|DER_ZONA);
+    st->carregados&=~(DER_SEC|DER_ZONA);
+    if(st->lj.fmt!=JOIAS_FMT_FIXO &&
+       (!dic_carregar(&st->dic[DIC_CAT],DIC_CAT) || !dic_carregar(&st->dic[DIC_MARCA],DIC_MARCA))){
+        snprintf(st->erro,sizeof st->erro,"%s está codificado, mas %s ou %s não pôde ser lido; importe o CSV novamente",
+                 PATH_JOIAS, PATH_JOIAS_CAT_DIC, PATH_JOIAS_MARCA_DIC);
+        dic_liberar(&st->dic[DIC_CAT]); dic_liberar(&st->dic[DIC_MARCA]);
+        fclose(st->joias); st->joias=NULL;
+        joias_layout(&st->lj,JOIAS_FMT_FIXO,0);
+        memset(&st->meta_joias,0,sizeof st->meta_joias);
+        st->indisponivel|=USO_JOIAS;
+        return;
+    }
+    if(meta_carregar(st->joias,PATH_JOIAS_META,TAB_JOIAS,&st->meta_joias)) st->derivados|=DER_META_JOIAS;
+    if(st->joias){
+        st->n_joias=(size_t)(st->lj.fmt==JOIAS_FMT_CMP? st->meta_joias.n_registros : joias_n_registros(&st->lj,fsize(st->joias)));
+        if(st->usar_mmap) mapa_abrir(&st->m_joias,st->joias);
+    }
+    FILE* idx=fopen(ger_arq(path,PATH_JOIAS_IDX),"rb");
+    if(!idx) return;
+    if(st->usar_mmap) mapa_abrir(&st->m_joias_idx,idx);
+    if(st->m_joias_idx.base){
+        st->jidx=(JoiasIdxEntry*)st->m_joias_idx.base;
+        st->n_jidx=st->m_joias_idx.len/sizeof(JoiasIdxEntry);
+    }else{
+        size_t n=fsize(idx)/sizeof(JoiasIdxEntry);
+        if(n){
+            st->jidx=malloc(n*sizeof *st->jidx); if(!st->jidx) die("malloc joias.idx");
+            st->n_jidx=fread(st->jidx,sizeof *st->jidx,n,idx);
+        }
+    }
+    fclose(idx);
+    if(st->busca_indice!=INDICE_BINARIA) indice_joias_montar(&st->ij,st->busca_indice,st->jidx,st->n_jidx);
+}
+static void store_carregar_pedidos(Store* st){
+    st->n_pedidos=0; st->n_pidx=0; st->pidx_ini=0; st->passo_pidx=1;
+    st->fmt_pedidos=PED_FMT_VAR;
+    char path[GER_CAMINHO];
+    st->pedidos=fopen(ger_arq(path,PATH_PEDIDOS),"rb");
+    if(st->pedidos) st->fmt_pedidos=ped_formato(st->pedidos);
+    st->indisponivel&=~USO_PEDIDOS;
+    st->derivados&=~(DER_META_PEDIDOS|DER_VENDAS);
+    st->carregados&=~DER_VENDAS;
+    vendas_liberar(&st->vendas);
+    if(meta_carregar(st->pedidos,PATH_PEDIDOS_META,TAB_PEDIDOS,&st->meta_pedidos)) st->derivados|=DER_META_PEDIDOS;
+    st->n_pedidos=(size_t)st->meta_pedidos.n_registros;
+    st->pedidos_idx=fopen(ger_arq(path,PATH_PEDIDOS_IDX),"rb");
+    if(st->pedidos_idx){
+        st->passo_pidx=pidx_passo(st->pedidos_idx);
+        st->pidx_ini=st->passo_pidx>1;
+        size_t n=fsize(st->pedidos_idx)/sizeof(PedidosIdxEntry);
+        st->n_pidx=n>st->pidx_ini? n-st->pidx_ini : 0;
+    }
+    if(st->pedidos_idx && st->busca_indice!=INDICE_BINARIA){
+        indice_pedidos_montar(&st->ip,st->busca_indice,st->pedidos_idx,st->pidx_ini,st->n_pidx);
+        st->n_pidx=st->ip.n;
+    }
+    if(st->usar_mmap){
+        mapa_abrir(&st->m_pedidos,st->pedidos);
+        mapa_abrir(&st->m_pedidos_idx,st->pedidos_idx);
+    }
+}
+static void store_soltar_joias(Store* st){
+    sec_liberar(&st->sec[SEC_NOME]); sec_liberar(&st->sec[SEC_CAT]);
+    zona_liberar(&st->zonas);
+    dic_liberar(&st->dic[DIC_CAT]); dic_liberar(&st->dic[DIC_MARCA]);
+    mapa_fechar(&st->m_joias);
+    if(st->m_joias_idx.base) mapa_fechar(&st->m_joias_idx);
+    else free(st->jidx);
+    st->jidx=NULL; st->n_jidx=0;
+    indice_liberar(&st->ij);
+    if(st->joias){ fclose(st->joias); st->joias=NULL; }
+}
+static void store_soltar_pedidos(Store* st){
+    mapa_fechar(&st->m_pedidos);
+    mapa_fechar(&st->m_pedidos_idx);
+    indice_liberar(&st->ip);
+    if(st->pedidos){ fclose(st->pedidos); st->pedidos=NULL; }
+    if(st->pedidos_idx){ fclose(st->pedidos_idx); st->pedidos_idx=NULL; }
+}
+static const char* const ger_arquivos[]={
+    PATH_JOIAS, PATH_JOIAS_IDX, PATH_JOIAS_META, PATH_JOIAS_ZONA, PATH_JOIAS_NOME_IDX, PATH_JOIAS_CAT_IDX,
+    PATH_JOIAS_CAT_DIC, PATH_JOIAS_MARCA_DIC, PATH_JOIAS_DELTA,
+    PATH_PEDIDOS, PATH_PEDIDOS_IDX, PATH_PEDIDOS_META, PATH_PEDIDOS_DELTA, PATH_VENDAS_AGG
+};
+#define N_GER_ARQUIVOS (sizeof ger_arquivos/sizeof ger_arquivos[0])
+
+static void ger_nome(char* dir, uint64_t g){
+    if(g) snprintf(dir,GER_DIR,"%s%llu/",GER_PREFIXO,(unsigned long long)g);
+    else dir[0]='\0';
+}
+static uint64_t manifesto_ler(void){
+    FILE* f=fopen(PATH_MANIFESTO,"rb"); if(!f) return 0;
+    GerCab cab;
+    int ok=fread(&cab,sizeof cab,1,f)==1 && memcmp(cab.magic,GER_MAGIC,sizeof cab.magic)==0;
+    fclose(f);
+    return ok? cab.geracao : GER_INVALIDA;
+}
+static void manifesto_gravar(uint64_t g){
+    GerCab cab; memset(&cab,0,sizeof cab);
+    memcpy(cab.magic,GER_MAGIC,sizeof cab.magic);
+    cab.geracao=g;
+    char tmp[64]; snprintf(tmp,sizeof tmp,"%s.tmp",PATH_MANIFESTO);
+    FILE* f=fopen(tmp,"wb"); if(!f) die(tmp);
+    int ok=fwrite(&cab,sizeof cab,1,f)==1;
+    if(fclose(f)!=0 || !ok){ remove(tmp); die(tmp); }
+    if(rename(tmp,PATH_MANIFESTO)!=0){ remove(tmp); die("mv geracao.man"); }
+}
+static int ger_travar(const char* dir, int criar, int modo){
+    char path[GER_CAMINHO]; snprintf(path,sizeof path,"%s%s",dir,PATH_GER_LOCK);
+    int fd=open(path,criar? O_RDWR|O_CREAT : O_RDONLY,0644);
+    if(fd<0) return -1;
+    if(flock(fd,modo)!=0){ close(fd); return -2; }
+    return fd;
+}
+static uint64_t ger_ultima(int publicada){
+    uint64_t ult=0;
+    size_t np=strlen(GER_PREFIXO);
+    DIR* d=opendir(".");
+    struct dirent* e;
+    while(d && (e=readdir(d))){
+        char* fim;
+        if(strncmp(e->d_name,GER_PREFIXO,np)!=0 || !isdigit((unsigned char)e->d_name[np])) continue;
+        unsigned long long g=strtoull(e->d_name+np,&fim,10);
+        if(*fim || g<=ult) continue;
+        char dir[GER_DIR], lock[GER_CAMINHO];
+        ger_nome(dir,g); snprintf(lock,sizeof lock,"%s%s",dir,PATH_GER_LOCK);
+        if(!publicada || access(lock,F_OK)==0) ult=g;
+    }
+    if(d) closedir(d);
+    return ult;
+}
+static void ger_fixar(Store* st){
+    for(int tentativas=0;;){
+        uint64_t g=manifesto_ler();
+        uint64_t ult=g? 0 : ger_ultima(1);
+        if(ult && tentativas++<GER_TENTATIVAS){
+            struct timespec ts={0,10*1000000L};
+            nanosleep(&ts,NULL);
+            continue;
+        }
+        if(g==GER_INVALIDA || ult){
+            st->ger=g? ger_ultima(0) : ult; st->fd_ger=-1;
+            ger_nome(ger_dir,st->ger);
+            snprintf(st->erro,sizeof st->erro,"%s %s; importe o CSV novamente", PATH_MANIFESTO, g? "inválido" : "ausente com diretórios ger.N/");
+            st->indisponivel=USO_JOIAS|USO_PEDIDOS;
+            return;
+        }
+        char dir[GER_DIR]; ger_nome(dir,g);
+        int fd=ger_travar(dir,0,LOCK_SH);
+        if(fd==-2) die("flock geracao.lock");
+        if(fd<0 && (errno!=ENOENT || (g && manifesto_ler()==g))) die(dir[0]? dir : PATH_GER_LOCK);
+        if(fd<0 && g) continue;
+        if(manifesto_ler()==g){
+            st->ger=g; st->fd_ger=fd;
+            memcpy(ger_dir,dir,sizeof ger_dir);
+            return;
+        }
+        if(fd>=0) close(fd);
+    }
+}
+static void ger_remover(uint64_t g){
+    char dir[GER_DIR];
+    ger_nome(dir,g);
+    if(!g) return;
+    int fd=ger_travar(dir,1,LOCK_EX|LOCK_NB);
+    if(fd<0) return;
+    DIR* d=opendir(dir);
+    struct dirent* e;
+    while(d && (e=readdir(d))){
+        if(strcmp(e->d_name,".")==0 || strcmp(e->d_name,"..")==0) continue;
+        char path[GER_DIR+sizeof e->d_name];
+        snprintf(path,sizeof path,"%s%s",dir,e->d_name);
+        remove(path);
+    }
+    if(d) closedir(d);
+    rmdir(dir);
+    close(fd);
+}
+static void ger_coletar(void){
+    uint64_t atual=manifesto_ler();
+    if(!atual || atual==GER_INVALIDA) return;
+    size_t np=strlen(GER_PREFIXO);
+    DIR* d=opendir(".");
+    struct dirent* e;
+    while(d && (e=readdir(d))){
+        char* fim;
+        if(strncmp(e->d_name,GER_PREFIXO,np)!=0 || !isdigit((unsigned char)e->d_name[np])) continue;
+        unsigned long long g=strtoull(e->d_name+np,&fim,10);
+        if(!*fim && g<atual) ger_remover(g);
+    }
+    if(d) closedir(d);
+}
+static int copiar_arquivo(const char* de, const char* para){
+    FILE* in=fopen(de,"rb"); if(!in) return errno==ENOENT;
+    FILE* out=fopen(para,"wb"); if(!out){ fclose(in); return 0; }
+    unsigned char buf[65536]; size_t r; int ok=1;
+    while(ok && (r=fread(buf,1,sizeof buf,in))>0) ok=fwrite(buf,1,r,out)==r;
+    fclose(in);
+    return fclose(out)==0 && ok;
+}
+static void vendas_salvar(Store* st);
+static void vendas_abrir(Store* st);
+static int derivado_atual(const char* nome, const char* magic, uint64_t checksum){
+    char path[GER_CAMINHO];
+    FILE* f=fopen(ger_arq(path,nome),"rb"); if(!f) return 0;
+    ZonaCab cab;
+    int ok=fread(&cab,sizeof cab.magic+sizeof cab.checksum,1,f)==1 && memcmp(cab.magic,magic,sizeof cab.magic)==0 && cab.checksum==checksum;
+    fclose(f);
+    return ok;
+}
+static void derivados_migrar(Store* st){
+    uint64_t cj=st->meta_joias.checksum;
+    if(st->joias && !(derivado_atual(PATH_JOIAS_NOME_IDX,SECIDX_MAGIC,cj) && derivado_atual(PATH_JOIAS_CAT_IDX,SECIDX_MAGIC,cj))) sec_abrir(st);
+    if(st->joias && !derivado_atual(PATH_JOIAS_ZONA,ZONA_MAGIC,cj)) zona_abrir(st);
+    if(st->pedidos && !derivado_atual(PATH_VENDAS_AGG,VENDAS_MAGIC,st->meta_pedidos.checksum)) vendas_abrir(st);
+}
+static void ger_derivados(Store* st){
+    if(st->derivados&DER_META_JOIAS){
+        meta_gravar(PATH_JOIAS_META,&st->meta_joias,st->joias);
+        printf("%s: metadados criados (%llu registros).\n", PATH_JOIAS_META, (unsigned long long)st->meta_joias.n_registros);
+    }
+    if(st->derivados&DER_META_PEDIDOS){
+        meta_gravar(PATH_PEDIDOS_META,&st->meta_pedidos,st->pedidos);
+        printf("%s: metadados criados (%llu registros).\n", PATH_PEDIDOS_META, (unsigned long long)st->meta_pedidos.n_registros);
+    }
+    if(st->derivados&DER_SEC){
+        sec_salvar(&st->sec[SEC_NOME],SEC_NOME,st->meta_joias.checksum);
+        sec_salvar(&st->sec[SEC_CAT],SEC_CAT,st->meta_joias.checksum);
+        printf("%s, %s: índices secundários criados.\n", PATH_JOIAS_NOME_IDX, PATH_JOIAS_CAT_IDX);
+    }
+    if(st->derivados&DER_ZONA){
+        zona_salvar(&st->zonas,st->meta_joias.checksum);
+        printf("%s: mapa de preços por bloco criado.\n", PATH_JOIAS_ZONA);
+    }
+    if(st->derivados&DER_VENDAS){
+        vendas_salvar(st);
+        printf("%s: agregado de vendas reconstruído.\n", PATH_VENDAS_AGG);
+    }
+    st->derivados=0;
+}
+static void ger_iniciar(Store* st, int herdar){
+    char dir[GER_DIR], de[GER_CAMINHO], para[GER_CAMINHO];
+    ger_nome(dir,st->ger+1);
+    ger_remover(st->ger+1);
+    if(mkdir(dir,0755)!=0) die(dir);
+    delta_sincronizar(st);
+    if(st->dj.log){ fclose(st->dj.log); st->dj.log=NULL; }
+    if(st->dp.log){ fclose(st->dp.log); st->dp.log=NULL; }
+    for(size_t i=0; herdar && i<N_GER_ARQUIVOS; i++){
+        const char* a=ger_arquivos[i];
+        ger_arq(de,a);
+        snprintf(para,sizeof para,"%s%s",dir,a);
+        if(strcmp(a,PATH_JOIAS_DELTA)==0 || strcmp(a,PATH_PEDIDOS_DELTA)==0){ if(!copiar_arquivo(de,para)) die(para); }
+        else if(link(de,para)!=0 && errno!=ENOENT) die(para);
+    }
+    memcpy(ger_dir,dir,sizeof ger_dir);
+    if(herdar) ger_derivados(st);
+}
+static void ger_publicar(Store* st){
+    int fd=ger_travar(ger_dir,1,LOCK_SH);
+    if(fd<0) die(PATH_GER_LOCK);
+    manifesto_gravar(st->ger+1);
+    if(st->fd_ger>=0) close(st->fd_ger);
+    st->fd_ger=fd; st->ger++;
+    ger_coletar();
+}
+static void ger_descartar(Store* st){
+    ger_remover(st->ger+1);
+    ger_nome(ger_dir,st->ger);
+}
+
+static void store_abrir(Store* st, size_t pool_bytes, int usar_mmap, int busca_indice){
+    memset(st,0,sizeof *st);
+    st->fd_escritor=-1;
+    ger_fixar(st);
+    pool_init(&st->pool,pool_bytes);
+    st->usar_mmap=usar_mmap;
+    st->busca_indice=busca_indice;
+    if(st->indisponivel) return;
+    store_carregar_joias(st);
+    store_carregar_pedidos(st);
+    delta_carregar(st,NULL);
+}
+static void store_fechar(Store* st){
+    store_soltar_joias(st);
+    store_soltar_pedidos(st);
+    delta_joias_limpar(&st->dj);
+    delta_pedidos_limpar(&st->dp);
+    vendas_liberar(&st->vendas);
+    pool_free(&st->pool);
+    if(st->fd_ger>=0) close(st->fd_ger);
+    ger_coletar();
+    if(st->fd_escritor>=0) close(st->fd_escritor);
+}
+static void store_recarregar_joias(Store* st, size_t rec_alterado){
+    store_soltar_joias(st);
+    store_carregar_joias(st);
+    pool_invalidar(&st->pool, ARQ_JOIAS, rec_alterado/st->lj.passo);
+}
+static void store_recarregar_pedidos(Store* st, size_t rec_alterado){
+    store_soltar_pedidos(st);
+    store_carregar_pedidos(st);
+    pool_invalidar(&st->pool, ARQ_PEDIDOS_IDX, (st->pidx_ini+rec_alterado/st->passo_pidx)/PEDIDOS_IDX_PAGINA);
+}
+static void store_atualizar(Store* st){
+    if(st->fd_escritor>=0) return;
+    char path[GER_CAMINHO];
+    uint64_t tj=tam_arquivo(ger_arq(path,PATH_JOIAS_DELTA)), tp=tam_arquivo(ger_arq(path,PATH_PEDIDOS_DELTA));
+    if(manifesto_ler()==st->ger && tj>=st->dj.tam && tp>=st->dp.tam){
+        if(tj==st->dj.tam && tp==st->dp.tam) return;
+        if(st->dj.log){ fclose(st->dj.log); st->dj.log=NULL; }
+        if(st->dp.log){ fclose(st->dp.log); st->dp.log=NULL; }
+        delta_carregar(st,(st->carregados&DER_VENDAS)? &st->vendas : NULL);
+        return;
+    }
+    size_t cap=st->pool.cap_bytes;
+    int usar_mmap=st->usar_mmap, busca=st->busca_indice;
+    store_fechar(st);
+    store_abrir(st,cap,usar_mmap,busca);
+}
+static void store_escritor(Store* st){
+    if(st->escritor_n){ st->escritor_n++; return; }
+    int fd=open(PATH_ESCRITOR_LOCK,O_RDWR|O_CREAT,0644); if(fd<0) die(PATH_ESCRITOR_LOCK);
+    if(flock(fd,LOCK_EX|LOCK_NB)!=0){
+        printf("Aguardando outro processo terminar de gravar...\n"); fflush(stdout);
+        if(flock(fd,LOCK_EX)!=0) die("flock escritor.lock");
+    }
+    store_atualizar(st);
+    derivados_migrar(st);
+    if(st->derivados) ger_derivados(st);
+    st->fd_escritor=fd; st->escritor_n=1;
+}
+static void store_soltar_escritor(Store* st){
+    if(!st->escritor_n || --st->escritor_n) return;
+    close(st->fd_escritor);
+    st->fd_escritor=-1;
+}
+static const char* store_exigir(Store* st, int uso){
+    if(!(st->indisponivel&uso)) return NULL;
+    printf("%s.\n", st->erro);
+    return st->erro;
+}
+
+static void cursor_abrir(Cursor* c, FILE* f, Mapa* m, const LayoutJoias* l){
+    memset(c,0,sizeof *c);
+    c->f=f; c->l=l; c->off=l->ini;
+    if(m && m->base){
+        c->m=m; c->n=(l->fmt==JOIAS_FMT_CMP? SIZE_MAX : (size_t)joias_n_registros(l,m->len));
+        madvise(m->base,m->len,MADV_SEQUENTIAL);
+    }else if(f){
+        if(fseek(f,(long)l->ini,SEEK_SET)!=0) die("seek cursor");
+        c->buf=malloc(l->tam_bloco); if(!c->buf) die("malloc cursor");
+    }
+}
+static const void* cursor_prox_cmp(Cursor* c){
+    const unsigned char* b; size_t len;
+    if(c->m){
+        if(c->off>=c->m->len) return NULL;
+        b=c->m->base+c->off; len=c->m->len-c->off;
+    }else{
+        if(!c->buf) return NULL;
+        if(c->buf_n-c->buf_i<JOIAS_CMP_REG_MAX && !feof(c->f)){
+            memmove(c->buf,c->buf+c->buf_i,c->buf_n-c->buf_i);
+            c->buf_n-=c->buf_i; c->buf_i=0;
+            c->buf_n+=fread(c->buf+c->buf_n,1,c->l->tam_bloco-c->buf_n,c->f);
+        }
+        if(c->buf_i>=c->buf_n) return NULL;
+        b=c->buf+c->buf_i; len=c->buf_n-c->buf_i;
+    }
+    size_t k=joias_cmp_decodificar(b,len,c->pos%c->l->passo==0,&c->dec,&c->dec);
+    if(!k) return NULL;
+    if(c->m) c->off+=k; else c->buf_i+=k;
+    c->pos++;
+    return &c->dec;
+}
+static const void* cursor_prox(Cursor* c){
+    if(c->l && c->l->fmt==JOIAS_FMT_CMP) return cursor_prox_cmp(c);
+    if(c->m){
+        if(c->pos>=c->n) return NULL;
+        return c->m->base + joias_offset(c->l,c->pos++);
+    }
+    if(!c->buf) return NULL;
+    if(c->buf_i==c->buf_n){
+        c->buf_n=fread(c->buf,1,c->l->tam_bloco,c->f)/c->l->tam;
+        if(c->buf_n>c->l->passo) c->buf_n=c->l->passo;
+        c->buf_i=0;
+        if(c->buf_n==0) return NULL;
+    }
+    c->pos++;
+    return c->buf + c->l->tam*c->buf_i++;
+}
+static void cursor_fechar(Cursor* c){
+    if(c->m) madvise(c->m->base,c->m->len,MADV_RANDOM);
+    free(c->buf);
+    memset(c,0,sizeof *c);
+}
+
+static void cursor_ped_abrir(CursorPed* c, Store* st){
+    memset(c,0,sizeof *c);
+    c->f=st->pedidos; c->fmt=st->fmt_pedidos;
+    c->pos=(size_t)ped_inicio(c->fmt);
+    if(st->m_pedidos.base){
+        c->m=&st->m_pedidos;
+        madvise(c->m->base,c->m->len,MADV_SEQUENTIAL);
+    }else if(c->f){
+        if(fseek(c->f,(long)c->pos,SEEK_SET)!=0) die("seek cursor pedidos");
+    }
+}
+static const PedidoVar* cursor_ped_prox(CursorPed* c){
+    if(c->m){
+        if(c->pos>=c->m->len) return NULL;
+        size_t k=ped_decodificar(c->m->base+c->pos,c->m->len-c->pos,c->fmt,&c->ped);
+        if(!k) return NULL;
+        c->pos+=k;
+        return &c->ped;
+    }
+    if(!c->f || !ped_ler(c->f,c->fmt,&c->ped)) return NULL;
+    return &c->ped;
+}
+static void cursor_ped_fechar(CursorPed* c){
+    if(c->m) madvise(c->m->base,c->m->len,MADV_RANDOM);
+    pedvar_free(&c->ped);
+    memset(c,0,sizeof *c);
+}
+
+static void iter_prod_abrir(IterProd* it, Store* st, const DeltaJoias* d){
+    memset(it,0,sizeof *it);
+    cursor_abrir(&it->c, st->joias, &st->m_joias, &st->lj);
+    it->d=d;
+    it->dic=(st->lj.fmt!=JOIAS_FMT_FIXO? st->dic : NULL);
+    it->avancar=1;
+}
+static const Produto* iter_prod_prox(IterProd* it){
+    for(;;){
+        if(it->avancar){
+            const void* r=cursor_prox(&it->c);
+            it->b=r;
+            if(r && it->dic){ joias_decodificar(it->dic,r,&it->dec); it->b=&it->dec; }
+            it->avancar=0;
+        }
+        const DeltaProd* dd=(it->di<it->d->n? &it->d->v[it->di] : NULL);
+        if(it->b && (!dd || it->b->id_produto<dd->p.id_produto)){
+            it->avancar=1;
+            return it->b;
+        }
+        if(!dd) return NULL;
+        it->di++;
+        if(it->b && it->b->id_produto==dd->p.id_produto) it->avancar=1;
+        if(dd->op==DELTA_INS) return &dd->p;
+    }
+}
+static void iter_prod_fechar(IterProd* it){
+    cursor_fechar(&it->c);
+}
+
+static void iter_ped_abrir(IterPed* it, Store* st, const DeltaPedidos* d){
+    memset(it,0,sizeof *it);
+    cursor_ped_abrir(&it->c, st);
+    it->d=d;
+    it->avancar=1;
+}
+static const PedidoVar* iter_ped_prox(IterPed* it){
+    for(;;){
+        if(it->avancar){ it->b=cursor_ped_prox(&it->c); it->avancar=0; }
+        const DeltaPed* dd=(it->di<it->d->n? &it->d->v[it->di] : NULL);
+        if(it->b && (!dd || it->b->id_pedido<dd->p.id_pedido)){
+            it->avancar=1;
+            return it->b;
+        }
+        if(!dd) return NULL;
+        it->di++;
+        if(it->b && it->b->id_pedido==dd->p.id_pedido) it->avancar=1;
+        if(dd->op==DELTA_INS) return &dd->p;
+    }
+}
+static void iter_ped_fechar(IterPed* it){
+    cursor_ped_fechar(&it->c);
+}
+
+static int store_pidx_entry(Store* st, size_t i, PedidosIdxEntry* e){
+    i+=st->pidx_ini;
+    if(st->m_pedidos_idx.base){
+        if((i+1)*sizeof *e>st->m_pedidos_idx.len) return 0;
+        *e=((const PedidosIdxEntry*)st->m_pedidos_idx.base)[i];
+        st->pool.diretos++;
+        return 1;
+    }
+    size_t len;
+    const unsigned char* pg=pool_bloco(&st->pool, st->pedidos_idx, ARQ_PEDIDOS_IDX, 0, i/PEDIDOS_IDX_PAGINA, PEDIDOS_IDX_PAGINA_BYTES, &len);
+    size_t k=i%PEDIDOS_IDX_PAGINA;
+    if(!pg || (k+1)*sizeof *e>len) return 0;
+    memcpy(e, pg+k*sizeof *e, sizeof *e);
+    return 1;
+}
+static int pedido_buscar_bloco(Store* st, uint64_t off, size_t passo, int64_t id, PedidoVar* ped){
+    if(!st->m_pedidos.base && (!st->pedidos || fseek(st->pedidos,(long)off,SEEK_SET)!=0)) return 0;
+    for(size_t r=0;r<passo;r++){
+        if(st->m_pedidos.base){
+            int64_t atual;
+            size_t k=off<st->m_pedidos.len? ped_espiar(st->m_pedidos.base+off,st->m_pedidos.len-off,st->fmt_pedidos,&atual) : 0;
+            if(!k || atual>id) return 0;
+            if(atual==id) return ped_decodificar(st->m_pedidos.base+off,st->m_pedidos.len-off,st->fmt_pedidos,ped)!=0;
+            off+=k;
+        }else{
+            if(!ped_ler(st->pedidos,st->fmt_pedidos,ped) || ped->id_pedido>id) return 0;
+            if(ped->id_pedido==id) return 1;
+        }
+    }
+    return 0;
+}
+
+static int joias_cmp_ler_bloco(const Store* st, size_t b, FILE* in, unsigned char* out, size_t* n){
+    if(b>=st->n_jidx) return 0;
+    uint64_t off=st->jidx[b].offset, fim=(b+1<st->n_jidx? st->jidx[b+1].offset : st->meta_joias.tam_bytes);
+    if(fim<=off) return 0;
+    size_t len=(size_t)(fim-off);
+    const unsigned char* raw;
+    unsigned char* tmp=NULL;
+    if(st->m_joias.base){
+        if(fim>st->m_joias.len) return 0;
+        raw=st->m_joias.base+off;
+    }else{
+        tmp=malloc(len); if(!tmp) die("malloc bloco");
+        if(!in || fseek(in,(long)off,SEEK_SET)!=0 || fread(tmp,1,len,in)!=len){ free(tmp); return 0; }
+        raw=tmp;
+    }
+    *n=joias_cmp_bloco(raw,len,st->lj.passo,out);
+    free(tmp);
+    return *n>0;
+}
+
+typedef int (*FnAceitarBloco)(void* acc, const Store* st, size_t bloco);
+typedef void (*FnBlocoJoias)(void* acc, const Store* st, const unsigned char* v, size_t n);
+typedef void (*FnPedido)(void* acc, const Store* st, const PedidoVar* ped);
+
+typedef struct {
+    const Store* st;
+    int tabela;
+    const size_t* blocos;
+    size_t ini, n, passo;
+    uint64_t off;
+    void* acc;
+    FnAceitarBloco aceitar;
+    FnBlocoJoias bloco;
+    FnPedido pedido;
+} FaixaVarredura;
+
+static int scan_threads(size_t n_registros){
+    long nt=(long)config_env("SCAN_THREADS",SCAN_THREADS,0);
+    if(nt<=0) nt=sysconf(_SC_NPROCESSORS_ONLN);
+    if(nt<1) nt=1;
+    if(nt>SCAN_THREADS_MAX) nt=SCAN_THREADS_MAX;
+    size_t max=n_registros/SCAN_REGISTROS_MIN; if(max<1) max=1;
+    if((size_t)nt>max) nt=(long)max;
+    return (int)nt;
+}
+static void* varrer_faixa(void* arg){
+    FaixaVarredura* f=arg;
+    const Store* st=f->st;
+    if(f->ini>=f->n) return NULL;
+    if(f->tabela==TAB_JOIAS){
+        size_t tam_bloco=st->lj.tam_bloco;
+        FILE* in=NULL; unsigned char* buf=NULL;
+        char path[GER_CAMINHO];
+        if(!st->m_joias.base || st->lj.fmt==JOIAS_FMT_CMP){
+            in=st->m_joias.base? NULL : fopen(ger_arq(path,PATH_JOIAS),"rb"); buf=malloc(tam_bloco);
+            if((!in && !st->m_joias.base) || !buf) die("varredura joias");
+        }
+        for(size_t i=f->ini; i<f->n; i+=f->passo){
+            size_t b=f->blocos? f->blocos[i] : i;
+            if(f->aceitar && !f->aceitar(f->acc,st,b)) break;
+            if(st->lj.fmt==JOIAS_FMT_CMP){
+                size_t n;
+                if(joias_cmp_ler_bloco(st,b,in,buf,&n)) f->bloco(f->acc,st,buf,n);
+                continue;
+            }
+            uint64_t off=st->lj.ini+(uint64_t)b*tam_bloco;
+            const unsigned char* v; size_t len;
+            if(st->m_joias.base){
+                if(off>=st->m_joias.len) continue;
+                v=st->m_joias.base+off; len=st->m_joias.len-off;
+                if(len>tam_bloco) len=tam_bloco;
+            }else{
+                if(fseek(in,(long)off,SEEK_SET)!=0) die("seek varredura");
+                len=fread(buf,1,tam_bloco,in); v=buf;
+            }
+            size_t n=len/st->lj.tam;
+            f->bloco(f->acc,st,v,n<st->lj.passo? n : st->lj.passo);
+        }
+        if(in) fclose(in);
+        free(buf);
+        return NULL;
+    }
+    PedidoVar ped; memset(&ped,0,sizeof ped);
+    if(st->m_pedidos.base){
+        size_t pos=(size_t)f->off;
+        for(size_t i=0;i<f->n && pos<st->m_pedidos.len;i++){
+            size_t k=ped_decodificar(st->m_pedidos.base+pos,st->m_pedidos.len-pos,st->fmt_pedidos,&ped);
+            if(!k) break;
+            pos+=k;
+            f->pedido(f->acc,st,&ped);
+        }
+    }else{
+        char path[GER_CAMINHO];
+        FILE* in=fopen(ger_arq(path,PATH_PEDIDOS),"rb"); if(!in) die("varredura pedidos");
+        if(fseek(in,(long)f->off,SEEK_SET)!=0) die("seek varredura");
+        for(size_t i=0;i<f->n && ped_ler(in,st->fmt_pedidos,&ped);i++) f->pedido(f->acc,st,&ped);
+        fclose(in);
+    }
+    pedvar_free(&ped);
+    return NULL;
+}
+static void varredura_executar(Store* st, int tabela, const size_t* blocos, size_t n, int nt, void* accs, size_t tam_acc,
+                               FnAceitarBloco aceitar, FnBlocoJoias bloco, FnPedido pedido){
+    if(!(tabela==TAB_JOIAS? st->joias : st->pedidos)) return;
+    FaixaVarredura fx[SCAN_THREADS_MAX];
+    for(int t=0;t<nt;t++){
+        FaixaVarredura* f=&fx[t];
+        memset(f,0,sizeof *f);
+        f->st=st; f->tabela=tabela; f->blocos=blocos;
+        f->acc=(unsigned char*)accs+(size_t)t*tam_acc;
+        f->aceitar=aceitar; f->bloco=bloco; f->pedido=pedido;
+        if(tabela==TAB_JOIAS){
+            f->ini=(size_t)t; f->n=n; f->passo=(size_t)nt;
+        }else if(!st->n_pidx){
+            f->n=(n && t==0)? SIZE_MAX : 0;
+            f->off=ped_inicio(st->fmt_pedidos);
+        }else{
+            size_t ne=n? st->n_pidx : 0, ini=ne*(size_t)t/(size_t)nt, fim=ne*(size_t)(t+1)/(size_t)nt;
+            f->n=ini==fim? 0 : t==nt-1? SIZE_MAX : (fim-ini)*st->passo_pidx;
+            PedidosIdxEntry e;
+            if(f->n && !store_pidx_entry(st,ini,&e)) die("pedidos.idx");
+            f->off=f->n? e.offset : 0;
+        }
+    }
+    pthread_t th[SCAN_THREADS_MAX];
+    for(int t=1;t<nt;t++) if(pthread_create(&th[t],NULL,varrer_faixa,&fx[t])!=0) die("pthread_create");
+    varrer_faixa(&fx[0]);
+    for(int t=1;t<nt;t++) pthread_join(th[t],NULL);
+}
+
+static void vendas_somar_pedido(Vendas* a, const PedidoVar* ped, int64_t sinal){
+    for(int32_t i=0,j;i<ped->n_itens;i=j){
+        for(j=i+1; j<ped->n_itens && ped->ids_produtos[j]==ped->ids_produtos[i]; j++);
+        vendas_somar(a, ped->ids_produtos[i], sinal*(j-i));
+    }
+}
+static void vendas_varrer_pedido(void* acc, const Store* st, const PedidoVar* ped){
+    (void)st;
+    vendas_somar_pedido(acc, ped, 1);
+}
+static void vendas_recalcular(Store* st, Vendas* a){
+    memset(a,0,sizeof *a);
+    int nt=scan_threads(st->pedidos? st->n_pedidos : 0);
+    Vendas* parc=calloc((size_t)nt,sizeof *parc); if(!parc) die("malloc vendas");
+    varredura_executar(st, TAB_PEDIDOS, NULL, st->pedidos? st->n_pedidos : 0, nt, parc, sizeof *parc, NULL, NULL, vendas_varrer_pedido);
+    for(int t=0;t<nt;t++){
+        vendas_consolidar(&parc[t]);
+        for(size_t i=0;i<parc[t].n;i++) vendas_somar(a, parc[t].v[i].id_produto, parc[t].v[i].unidades);
+        vendas_liberar(&parc[t]);
+    }
+    free(parc);
+    vendas_consolidar(a);
+}
+static int buscar_pedido_base(Store* st, int64_t target, PedidoVar* ped);
+static void vendas_aplicar_delta(Store* st, Vendas* a, int64_t sinal){
+    PedidoVar ped; memset(&ped,0,sizeof ped);
+    for(size_t i=0;i<st->dp.n;i++){
+        const DeltaPed* d=&st->dp.v[i];
+        if(buscar_pedido_base(st,d->p.id_pedido,&ped)) vendas_somar_pedido(a,&ped,-sinal);
+        if(d->op==DELTA_INS) vendas_somar_pedido(a,&d->p,sinal);
+    }
+    pedvar_free(&ped);
+    vendas_consolidar(a);
+}
+static void vendas_salvar(Store* st){
+    if(!st->pedidos && !st->dp.n) return;
+    vendas_consolidar(&st->vendas);
+    Vendas base; memset(&base,0,sizeof base);
+    base.n=st->vendas.n;
+    base.v=malloc((base.n? base.n:1)*sizeof *base.v); if(!base.v) die("malloc vendas");
+    memcpy(base.v,st->vendas.v,base.n*sizeof *base.v);
+    vendas_aplicar_delta(st,&base,-1);
+    vendas_gravar(&base, st->meta_pedidos.checksum);
+    vendas_liberar(&base);
+    st->derivados&=~DER_VENDAS;
+}
+static void vendas_abrir(Store* st){
+    if(st->carregados&DER_VENDAS) return;
+    st->carregados|=DER_VENDAS;
+    if(!st->pedidos && !st->dp.n) return;
+    VendasCab cab;
+    if(!st->pedidos){
+        vendas_aplicar_delta(st, &st->vendas, 1);
+        return;
+    }
+    if(!vendas_ler(&st->vendas,&cab) || cab.checksum!=st->meta_pedidos.checksum){
+        vendas_liberar(&st->vendas);
+        vendas_recalcular(st, &st->vendas);
+        st->derivados|=DER_VENDAS;
+    }
+    vendas_aplicar_delta(st, &st->vendas, 1);
+}
+
+typedef struct {
+    const char* ini;
+    const char* fim;
+    ProdutoTmp* prods; size_t nP, capP;
+    size_t* tab; size_t cap_tab;
+    DupProd dup;
+    LinhaTmp* linhas; size_t nL, capL;
+    size_t ok, skip;
+    size_t limite;
+    ListaRuns runs_prod, runs_linhas;
+} ParteImport;
+
+static int merge_menor(const MergeRuns* m, size_t a, size_t b){
+    int c=m->cmp(m->recs+a*m->tam, m->recs+b*m->tam);
+    return c<0 || (c==0 && a<b);
+}
+static void merge_descer(MergeRuns* m, size_t i){
+    for(;;){
+        size_t l=2*i+1, r=l+1, x=i;
+        if(l<m->nh && merge_menor(m,m->heap[l],m->heap[x])) x=l;
+        if(r<m->nh && merge_menor(m,m->heap[r],m->heap[x])) x=r;
+        if(x==i) return;
+        size_t t=m->heap[i]; m->heap[i]=m->heap[x]; m->heap[x]=t;
+        i=x;
+    }
+}
+static void merge_abrir(MergeRuns* m, FILE** runs, size_t n, size_t tam, int (*cmp)(const void*, const void*)){
+    m->runs=runs; m->nruns=n; m->tam=tam; m->cmp=cmp; m->nh=0;
+    m->recs=malloc((n? n:1)*tam); m->heap=malloc((n? n:1)*sizeof *m->heap);
+    if(!m->recs || !m->heap) die("malloc merge");
+    for(size_t i=0;i<n;i++){
+        rewind(runs[i]);
+        if(fread(m->recs+i*tam,tam,1,runs[i])==1) m->heap[m->nh++]=i;
+    }
+    for(size_t i=m->nh/2;i-->0;) merge_descer(m,i);
+}
+static int merge_prox(MergeRuns* m, void* out){
+    if(!m->nh) return 0;
+    size_t r=m->heap[0];
+    memcpy(out,m->recs+r*m->tam,m->tam);
+    if(fread(m->recs+r*m->tam,m->tam,1,m->runs[r])!=1) m->heap[0]=m->heap[--m->nh];
+    if(m->nh) merge_descer(m,0);
+    return 1;
+}
+static void merge_fechar(MergeRuns* m){
+    free(m->recs); free(m->heap);
+    for(size_t i=0;i<m->nruns;i++) fclose(m->runs[i]);
+}
+
+static void runs_anexar(ListaRuns* r, FILE* f){
+    if(r->n==r->cap){
+        r->cap=r->cap? r->cap*2 : 16;
+        r->v=realloc(r->v,r->cap*sizeof *r->v); if(!r->v) die("realloc runs");
+    }
+    r->v[r->n++]=f;
+}
+static void runs_reduzir(ListaRuns* r, size_t tam, int (*cmp)(const void*, const void*), DupProd* dup){
+    FILE* f=tmpfile(); if(!f) die("tmpfile run");
+    unsigned char* rec=malloc(2*tam); if(!rec) die("malloc run");
+    MergeRuns m; merge_abrir(&m,r->v,r->n,tam,cmp);
+    int tem=0;
+    while(merge_prox(&m,rec)){
+        if(!dup){ if(fwrite(rec,tam,1,f)!=1) die("w run"); continue; }
+        if(tem && cmp(rec,rec+tam)==0){ dup_registrar(dup,(ProdutoTmp*)(rec+tam),(const ProdutoTmp*)rec); continue; }
+        if(tem && fwrite(rec+tam,tam,1,f)!=1) die("w run");
+        memcpy(rec+tam,rec,tam); tem=1;
+    }
+    if(tem && fwrite(rec+tam,tam,1,f)!=1) die("w run");
+    merge_fechar(&m);
+    free(rec);
+    r->n=0;
+    runs_anexar(r,f);
+}
+static void tab_prod_reconstruir(ParteImport* pt, size_t cap){
+    free(pt->tab);
+    pt->tab=calloc(cap,sizeof *pt->tab); if(!pt->tab) die("calloc tabela produtos");
+    pt->cap_tab=cap;
+    for(size_t i=0;i<pt->nP;i++){
+        size_t h=(size_t)hash_id(pt->prods[i].id_produto)&(cap-1);
+        while(pt->tab[h]) h=(h+1)&(cap-1);
+        pt->tab[h]=i+1;
+    }
+}
+static void import_produto(ParteImport* pt, const ProdutoTmp* novo){
+    if(!pt->cap_tab) tab_prod_reconstruir(pt,4096);
+    size_t h=(size_t)hash_id(novo->id_produto)&(pt->cap_tab-1);
+    while(pt->tab[h]){
+        ProdutoTmp* p=&pt->prods[pt->tab[h]-1];
+        if(p->id_produto==novo->id_produto){ dup_registrar(&pt->dup,p,novo); return; }
+        h=(h+1)&(pt->cap_tab-1);
+    }
+    if(pt->nP==pt->capP){ pt->capP=pt->capP? pt->capP*2 : 2048; pt->prods=realloc(pt->prods,pt->capP*sizeof *pt->prods); if(!pt->prods) die("realloc prods"); }
+    pt->prods[pt->nP++]=*novo;
+    pt->tab[h]=pt->nP;
+    if(pt->nP*2>pt->cap_tab) tab_prod_reconstruir(pt,pt->cap_tab*2);
+}
+
+static uint64_t import_memoria(uint64_t nP, uint64_t nL){
+    return 2*(nP*sizeof(ProdutoTmp)+nL*sizeof(LinhaTmp)) + 4*nP*sizeof(size_t) + 2*(nP>nL? nP:nL)*sizeof(ChaveIdx);
+}
+static uint64_t import_estimar(uint64_t len, const char* amostra, size_t n){
+    size_t nl=0;
+    for(const char* q=amostra; q<amostra+n && (q=memchr(q,'\n',(size_t)(amostra+n-q))); q++) nl++;
+    uint64_t linhas=(uint64_t)((double)len*(double)(nl+1)/(double)(n? n:1))+1;
+    return import_memoria(linhas,linhas);
+}
+
+static void import_despejar(ParteImport* pt){
+    if(pt->nP){
+        ChaveIdx* ord=ordenar_produtos(pt->prods,pt->nP);
+        FILE* f=tmpfile(); if(!f) die("tmpfile run");
+        for(size_t i=0;i<pt->nP;i++){
+            const ProdutoTmp* p=&pt->prods[ord[i].idx];
+            if(i && p->id_produto==pt->prods[ord[i-1].idx].id_produto) continue;
+            if(fwrite(p,sizeof *p,1,f)!=1) die("w run");
+        }
+        free(ord);
+        runs_anexar(&pt->runs_prod,f);
+        if(pt->runs_prod.n>=IMPORT_MAX_RUNS) runs_reduzir(&pt->runs_prod,sizeof(ProdutoTmp),cmp_produto_id,&pt->dup);
+    }
+    if(pt->nL){
+        ChaveIdx* ord=ordenar_linhas(pt->linhas,pt->nL);
+        FILE* f=tmpfile(); if(!f) die("tmpfile run");
+        for(size_t i=0;i<pt->nL;i++)
+            if(fwrite(&pt->linhas[ord[i].idx],sizeof(LinhaTmp),1,f)!=1) die("w run");
+        free(ord);
+        runs_anexar(&pt->runs_linhas,f);
+        if(pt->runs_linhas.n>=IMPORT_MAX_RUNS) runs_reduzir(&pt->runs_linhas,sizeof(LinhaTmp),cmp_linha_by_pedido_then_prod,NULL);
+    }
+    pt->nP=pt->nL=0;
+    if(pt->cap_tab) memset(pt->tab,0,pt->cap_tab*sizeof *pt->tab);
+}
+
+static const char* fim_registro(const char* p, const char* fim, int* aspas){
+    while(p<fim){
+        const char* nl=memchr(p,'\n',(size_t)(fim-p));
+        const char* lim=(nl? nl : fim);
+        for(const char* q=p; q<lim && (q=memchr(q,'"',(size_t)(lim-q))); q++) *aspas^=1;
+        if(!*aspas || !nl) return lim;
+        p=nl+1;
+    }
+    return fim;
+}
+
+static void importar_registro(ParteImport* pt, char* line, char** col, char* cell, size_t cellsz){
+    rstrip(line); if(!line[0]) return;
+    int nf=parse_csv_line(line,col,32,cell,cellsz);
+    if(nf<0){ pt->skip++; return; }
+    if(nf<8){ pt->skip++; return; }
+
+    int64_t order_id=0, prod_id=0; int32_t qty=0; double price=0.0;
+    const char* s_order = (nf>1? col[1]:"");
+    const char* s_prod  = (nf>2? col[2]:"");
+    const char* s_qty   = (nf>3? col[3]:"");
+    const char* s_cat   = (nf>5? col[5]:"");
+    const char* s_price = (nf>7? col[7]:"");
+    const char* s_cor   = (nf>10? col[10]:"");
+    const char* s_metal = (nf>11? col[11]:"");
+    const char* s_pedra = (nf>12? col[12]:"");
+
+    if(!try_i64(s_order,&order_id) || !try_i64(s_prod,&prod_id) || !try_i32(s_qty,&qty) || !try_f64(s_price,&price)){
+        pt->skip++; return;
+    }
+
+    ProdutoTmp pr;
+    pr.id_produto=prod_id;
+    safe_copy(pr.categoria,CAT_MAX, s_cat);
+    safe_copy(pr.marca,MARCA_MAX, s_metal?s_metal:"");
+    build_nome(pr.nome,NOME_MAX, s_cat,s_cor,s_metal,s_pedra);
+    pr.preco=pr.preco_min=pr.preco_max=price;
+    pr.conflito=0;
+    import_produto(pt,&pr);
+
+    if(pt->nL==pt->capL){ pt->capL=pt->capL? pt->capL*2 : 4096; pt->linhas=realloc(pt->linhas,pt->capL*sizeof *pt->linhas); if(!pt->linhas) die("realloc linhas"); }
+    LinhaTmp* l=&pt->linhas[pt->nL++];
+    l->id_pedido=order_id; l->id_produto=prod_id; l->quantidade=qty;
+
+    pt->ok++;
+}
+
+static void* importar_parte(void* arg){
+    ParteImport* pt=(ParteImport*)arg;
+    size_t cap=8192;
+    char* line=malloc(cap); char* cell=malloc(2*cap); char* col[32];
+    if(!line || !cell) die("malloc linha");
+    const char* p=pt->ini;
+    while(p<pt->fim){
+        int aspas=0;
+        const char* e=fim_registro(p,pt->fim,&aspas);
+        size_t n=(size_t)(e-p);
+        if(n+1>cap){
+            while(n+1>cap) cap*=2;
+            free(line); free(cell);
+            line=malloc(cap); cell=malloc(2*cap);
+            if(!line || !cell) die("malloc linha");
+        }
+        memcpy(line,p,n); line[n]='\0';
+        p=(e<pt->fim? e+1 : pt->fim);
+        importar_registro(pt,line,col,cell,2*cap);
+        if(pt->limite && import_memoria(pt->nP,pt->nL)>=pt->limite) import_despejar(pt);
+    }
+    free(line); free(cell);
+    return NULL;
+}
+
+static int import_threads(size_t len){
+    long nt=(long)config_env("IMPORT_THREADS",IMPORT_THREADS,0);
+    if(nt<=0) nt=sysconf(_SC_NPROCESSORS_ONLN);
+    if(nt<1) nt=1;
+    if(nt>IMPORT_THREADS_MAX) nt=IMPORT_THREADS_MAX;
+    size_t max=len/IMPORT_PARTE_MIN; if(max<1) max=1;
+    if((size_t)nt>max) nt=(long)max;
+    return (int)nt;
+}
+
+static void importar_fluxo(ParteImport* pt, FILE* in){
+    size_t cap=IMPORT_BLOCO, n=0;
+    char* buf=malloc(cap); if(!buf) die("malloc CSV");
+    int fim=0;
+    while(!fim || n){
+        if(!fim){
+            n+=fread(buf+n,1,cap-n,in);
+            if(n<cap){ if(ferror(in)) die("read CSV"); fim=1; }
+        }
+        const char* e=buf+n; const char* p=e;
+        if(!fim){
+            p=buf;
+            for(;;){
+                int aspas=0;
+                const char* r=fim_registro(p,e,&aspas);
+                if(r>=e) break;
+                p=r+1;
+            }
+            if(p==buf){ cap*=2; buf=realloc(buf,cap); if(!buf) die("realloc CSV"); continue; }
+        }
+        pt->ini=buf; pt->fim=p;
+        importar_parte(pt);
+        n=(size_t)(e-p);
+        memmove(buf,p,n);
+    }
+    free(buf);
+}
+
+static const char* import_dic_cheio(void){
+    printf("Dicionário de categoria ou marca cheio (%d valores distintos); arquivos existentes mantidos.\n", DIC_MAX);
+    return "dicionário de categoria ou marca cheio";
+}
+static const char* importar_externo(Store* st, const char* base, size_t len, FILE* in, uint32_t paginas, size_t passo_idx, size_t limite){
+    ParteImport pt; memset(&pt,0,sizeof pt);
+    pt.limite=limite;
+    if(in) importar_fluxo(&pt,in);
+    else{
+        pt.ini=base; pt.fim=base+len;
+        importar_parte(&pt);
+    }
+    import_despejar(&pt);
+    free(pt.prods); free(pt.linhas); free(pt.tab);
+    printf("CSV lido: %zu válidas, %zu puladas\n", pt.ok, pt.skip);
+    printf("Importação externa (limite de %zu bytes): %zu runs de produtos, %zu runs de linhas\n",
+           limite, pt.runs_prod.n, pt.runs_linhas.n);
+    if(!pt.runs_prod.n && !pt.runs_linhas.n){
+        free(pt.runs_prod.v); free(pt.runs_linhas.v);
+        printf("Nenhuma linha válida; arquivos existentes mantidos.\n");
+        return "nenhuma linha válida no CSV";
+    }
+
+    ger_iniciar(st,0);
+    MergeRuns m; ProdutoTmp p, ant;
+    EscritorJoias ej; memset(&ej,0,sizeof ej);
+    ej.paginas=paginas;
+    ej.dup=&pt.dup;
+    int tem=0, ok=1;
+    merge_abrir(&m,pt.runs_prod.v,pt.runs_prod.n,sizeof p,cmp_produto_id);
+    while(ok && merge_prox(&m,&p)){
+        if(tem && p.id_produto==ant.id_produto){ dup_registrar(&pt.dup,&ant,&p); continue; }
+        if(tem) ok=escritor_joias_gravar(&ej,&ant);
+        ant=p; tem=1;
+    }
+    if(ok && tem) ok=escritor_joias_gravar(&ej,&ant);
+    merge_fechar(&m);
+    if(!ok){
+        escritor_joias_descartar(&ej);
+        for(size_t i=0;i<pt.runs_linhas.n;i++) fclose(pt.runs_linhas.v[i]);
+        free(pt.runs_prod.v); free(pt.runs_linhas.v);
+        ger_descartar(st);
+        return import_dic_cheio();
+    }
+    escritor_joias_fechar(&ej);
+
+    LinhaTmp l;
+    EscritorPedidos ep; memset(&ep,0,sizeof ep);
+    ep.passo=passo_idx;
+    merge_abrir(&m,pt.runs_linhas.v,pt.runs_linhas.n,sizeof l,cmp_linha_by_pedido_then_prod);
+    while(merge_prox(&m,&l)) escritor_pedidos_linha(&ep,&l);
+    merge_fechar(&m);
+    escritor_pedidos_fechar(&ep);
+    free(pt.runs_prod.v); free(pt.runs_linhas.v);
+
+    delta_descartar(st);
+    ger_publicar(st);
+    store_recarregar_joias(st,0);
+    store_recarregar_pedidos(st,0);
+    return NULL;
+}
+
+static const char* cmd_import(Store* st, const char* csv, uint32_t paginas, size_t passo_idx){
+    if(paginas>JOIAS_PAGINAS_MAX){ printf("Páginas por bloco inválidas (1 a %d, ou cmp para blocos comprimidos).\n", JOIAS_PAGINAS_MAX); return "páginas por bloco inválidas"; }
+    if(passo_idx<1 || passo_idx>PEDIDOS_IDX_PASSO_MAX){ printf("Passo do pedidos.idx inválido (1 a %d).\n", PEDIDOS_IDX_PASSO_MAX); return "passo do pedidos.idx inválido"; }
+    FILE* in=fopen(csv,"r");
+    if(!in){ printf("Não foi possível abrir %s: %s\n", csv, strerror(errno)); return "não foi possível abrir o CSV"; }
+    store_escritor(st);
+    size_t len=fsize(in);
+    char* base=NULL; int mapeado=0;
+    uint64_t mem=0;
+    if(len){
+        base=mmap(NULL,len,PROT_READ,MAP_PRIVATE,fileno(in),0);
+        if(base!=MAP_FAILED){
+            mapeado=1; madvise(base,len,MADV_SEQUENTIAL);
+            mem=import_estimar(len,base,len<IMPORT_AMOSTRA? len : IMPORT_AMOSTRA);
+        }else{
+            char* amostra=malloc(IMPORT_AMOSTRA); if(!amostra) die("malloc CSV");
+            size_t n=fread(amostra,1,IMPORT_AMOSTRA,in);
+            mem=len+import_estimar(len,amostra,n);
+            free(amostra);
+            if(fseek(in,0,SEEK_SET)!=0) die("seek CSV");
+            base=NULL;
+        }
+    }
+
+    size_t limite=(size_t)config_env("IMPORT_MEM_BUDGET",IMPORT_MEM_BUDGET,1);
+    if(mem > (uint64_t)limite){
+        const char* erro=importar_externo(st,base,len,mapeado? NULL : in,paginas,passo_idx,limite);
+        if(mapeado) munmap(base,len);
+        fclose(in);
+        store_soltar_escritor(st);
+        return erro;
+    }
+    if(len && !mapeado){
+        base=malloc(len); if(!base) die("malloc CSV");
+        if(fread(base,1,len,in)!=len) die("read CSV");
+    }
+    fclose(in);
+
+    int nt=import_threads(len);
+    ParteImport partes[IMPORT_THREADS_MAX];
+    memset(partes,0,sizeof partes);
+    const char* pos=base; const char* fim=base+len;
+    for(int t=0;t<nt;t++){
+        partes[t].ini=pos;
+        const char* alvo=base+len/(size_t)nt*(size_t)(t+1);
+        if(t==nt-1 || alvo<=pos) alvo=fim;
+        else{
+            int aspas=0;
+            for(const char* q=pos; q<alvo && (q=memchr(q,'"',(size_t)(alvo-q))); q++) aspas^=1;
+            const char* e=fim_registro(alvo,fim,&aspas);
+            alvo=(e<fim? e+1 : fim);
+        }
+        partes[t].fim=alvo; pos=alvo;
+    }
+    pthread_t th[IMPORT_THREADS_MAX];
+    for(int t=1;t<nt;t++) if(pthread_create(&th[t],NULL,importar_parte,&partes[t])!=0) die("pthread_create");
+    importar_parte(&partes[0]);
+    for(int t=1;t<nt;t++) pthread_join(th[t],NULL);
+    if(mapeado) munmap(base,len); else free(base);
+
+    ParteImport* pt=&partes[0];
+    size_t nL=0, ok=0, skip=0;
+    for(int t=0;t<nt;t++){ nL+=partes[t].nL; ok+=partes[t].ok; skip+=partes[t].skip; }
+    LinhaTmp* linhas=pt->linhas;
+    if(nt>1){
+        linhas=realloc(linhas,(nL? nL:1)*sizeof *linhas); if(!linhas) die("realloc linhas");
+        size_t wL=pt->nL;
+        for(int t=1;t<nt;t++){
+            for(size_t i=0;i<partes[t].nP;i++) import_produto(pt,&partes[t].prods[i]);
+            dup_somar(&pt->dup,&partes[t].dup);
+            if(partes[t].nL) memcpy(linhas+wL,partes[t].linhas,partes[t].nL*sizeof *linhas);
+            wL+=partes[t].nL;
+            free(partes[t].prods); free(partes[t].linhas); free(partes[t].tab);
+        }
+    }
+    ProdutoTmp* prods=pt->prods; size_t nP=pt->nP;
+    free(pt->tab);
+    printf("CSV lido: %zu válidas, %zu puladas\n", ok, skip);
+    if(nP==0 && nL==0){
+        free(prods); free(linhas);
+        store_soltar_escritor(st);
+        printf("Nenhuma linha válida; arquivos existentes mantidos.\n");
+        return "nenhuma linha válida no CSV";
+    }
+
+    ger_iniciar(st,0);
+    if(!write_joias(prods,nP,paginas,&pt->dup)){
+        free(prods); free(linhas);
+        ger_descartar(st);
+        store_soltar_escritor(st);
+        return import_dic_cheio();
+    }
+    write_pedidos_and_index(linhas,nL,passo_idx);
+    free(prods); free(linhas);
+    delta_descartar(st);
+    ger_publicar(st);
+    store_recarregar_joias(st,0);
+    store_recarregar_pedidos(st,0);
+    store_soltar_escritor(st);
+    return NULL;
+}
+
+static const unsigned char* store_bloco_joias(Store* st, size_t b, size_t* n){
+    size_t tam_bloco=st->lj.tam_bloco;
+    if(st->lj.fmt==JOIAS_FMT_CMP){
+        size_t len;
+        const unsigned char* v=pool_buscar(&st->pool,ARQ_JOIAS,b,&len);
+        if(!v){
+            unsigned char* buf=malloc(tam_bloco); if(!buf) die("malloc bloco");
+            if(!joias_cmp_ler_bloco(st,b,st->joias,buf,n)){ free(buf); return NULL; }
+            v=pool_guardar(&st->pool,ARQ_JOIAS,b,buf,*n*st->lj.tam);
+            len=*n*st->lj.tam;
+        }
+        *n=len/st->lj.tam;
+        return v;
+    }
+    uint64_t off=st->lj.ini+(uint64_t)b*tam_bloco;
+    const unsigned char* bloco;
+    size_t len;
+    if(st->m_joias.base){
+        if(off>=st->m_joias.len) return NULL;
+        bloco=st->m_joias.base+off;
+        len=st->m_joias.len-off;
+        if(len>tam_bloco) len=tam_bloco;
+        st->pool.diretos++;
+    }else{
+        bloco=pool_bloco(&st->pool,st->joias,ARQ_JOIAS,st->lj.ini,b,tam_bloco,&len);
+        if(!bloco) return NULL;
+    }
+    *n=len/st->lj.tam;
+    if(*n>st->lj.passo) *n=st->lj.passo;
+    return bloco;
+}
+static int64_t joia_id(const Store* st, const unsigned char* bloco, size_t i){
+    int64_t id; memcpy(&id,bloco+i*st->lj.tam,sizeof id);
+    return id;
+}
+static double joia_preco(const Store* st, const unsigned char* bloco, size_t i){
+    double preco; memcpy(&preco,bloco+i*st->lj.tam+joias_off_preco(st->lj.fmt),sizeof preco);
+    return preco;
+}
+static void joia_ler(const Store* st, const unsigned char* bloco, size_t i, Produto* p){
+    joias_decodificar(st->lj.fmt!=JOIAS_FMT_FIXO? st->dic : NULL, bloco+i*st->lj.tam, p);
+}
+
+static size_t joia_buscar_bloco(const Store* st, const unsigned char* v, size_t lo, size_t hi, int64_t id){
+    while(lo<hi){
+        size_t mid=(lo+hi)/2;
+        if(joia_id(st,v,mid)<id) lo=mid+1; else hi=mid;
+    }
+    return lo;
+}
+
+static size_t jidx_ate(const JoiasIdxEntry* v, size_t n, int64_t id){
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (v[mid].id_base <= id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int buscar_produto_por_id(Store* st, int64_t id_produto, Produto* resultado) {
+    const DeltaProd* d = delta_joias_buscar(&st->dj, id_produto);
+    if (d) {
+        if (d->op != DELTA_INS) return 0;
+        *resultado = d->p;
+        return 1;
+    }
+    if (st->n_jidx == 0) return 0;
+    
+    size_t lo = st->busca_indice != INDICE_BINARIA ? indice_ate(&st->ij, id_produto) : jidx_ate(st->jidx, st->n_jidx, id_produto);
+    size_t base = (lo == 0 ? 0 : lo - 1);
+    
+    size_t n;
+    const unsigned char* v = store_bloco_joias(st, base, &n);
+    if (!v) return 0;
+    size_t r = joia_buscar_bloco(st, v, 0, n, id_produto);
+    if (r == n || joia_id(st, v, r) != id_produto) return 0;
+    joia_ler(st, v, r, resultado);
+    return 1;
+}
+
+static const char* cmd_find_prod(Store* st, const char* s){
+    int64_t target; if(!try_i64(s,&target)){ fprintf(stderr,"id_produto inválido\n"); return "id_produto inválido"; }
+    Produto p;
+    if(buscar_produto_por_id(st,target,&p)){
+        printf("Produto: id=%lld nome=\"%.*s\" cat=\"%.*s\" marca=\"%.*s\" preco=%.2f\n",
+               (long long)p.id_produto, (int)NOME_MAX, p.nome, (int)CAT_MAX, p.categoria, (int)MARCA_MAX, p.marca, p.preco);
+    }else{
+        printf("Produto %lld não encontrado.\n", (long long)target);
+        return "produto não encontrado";
+    }
+    return NULL;
+}
+
+static size_t pidx_lower_bound(Store* st, int64_t target){
+    size_t lo=0, hi=st->n_pidx;
+    while(lo<hi){
+        size_t mid=(lo+hi)/2;
+        PedidosIdxEntry entry;
+        if(!store_pidx_entry(st,mid,&entry)) die("read ped.idx mid");
+        if(entry.id_pedido<target) lo=mid+1; else hi=mid;
+    }
+    return lo;
+}
+
+static int buscar_pedido_base(Store* st, int64_t target, PedidoVar* ped){
+    PedidosIdxEntry found_entry;
+    if(st->busca_indice!=INDICE_BINARIA){
+        size_t i=indice_ate(&st->ip,target);
+        if(!i) return 0;
+        found_entry.id_pedido=st->ip.chaves[i-1]; found_entry.offset=st->ip.offsets[i-1];
+    }else{
+        size_t i=target==INT64_MAX? st->n_pidx : pidx_lower_bound(st,target+1);
+        if(!i || !store_pidx_entry(st,i-1,&found_entry)) return 0;
+    }
+    if(st->passo_pidx==1 && found_entry.id_pedido!=target) return 0;
+    return pedido_buscar_bloco(st,found_entry.offset,st->passo_pidx,target,ped);
+}
+static int buscar_pedido(Store* st, int64_t target, PedidoVar* ped){
+    const DeltaPed* d=delta_pedidos_buscar(&st->dp,target);
+    if(d){
+        if(d->op!=DELTA_INS) return 0;
+        ped->id_pedido=d->p.id_pedido; ped->n_itens=d->p.n_itens;
+        pedvar_reservar(ped,(size_t)d->p.n_itens);
+        if(d->p.n_itens) memcpy(ped->ids_produtos,d->p.ids_produtos,(size_t)d->p.n_itens*sizeof(int64_t));
+        return 1;
+    }
+    return buscar_pedido_base(st,target,ped);
+}
+
+static const char* cmd_find_pedido(Store* st, const char* s){
+    int64_t target; if(!try_i64(s,&target)){ fprintf(stderr,"id_pedido inválido\n"); return "id_pedido inválido"; }
+    if(!st->pedidos_idx && !st->dp.n){ printf("Índice de pedidos ausente. Faça import/insert/remove primeiro.\n"); return "pedidos.idx ausente"; }
+    
+    PedidoVar ped; memset(&ped,0,sizeof ped);
+    if(!buscar_pedido(st,target,&ped)){
+        printf("Pedido %lld não encontrado.\n",(long long)target);
+        pedvar_free(&ped);
+        return "pedido não encontrado";
+    }
+    printf("Pedido %lld — n_itens=%d\n", (long long)ped.id_pedido, ped.n_itens);
+    for(int32_t i=0;i<ped.n_itens;i++){
+        printf("  item%03d -> id_produto=%lld\n", i+1, (long long)ped.ids_produtos[i]);
+    }
+    pedvar_free(&ped);
+    return NULL;
+}
+
+static size_t multiget_produtos(Store* st, const int64_t* ids, size_t n, Produto* out, unsigned char* achado, size_t* lidos){
+    ChaveIdx* ord=ordenar_chaves(ids,n);
+    size_t k=0, pos=0, bloco=SIZE_MAX, nreg=0, r=0;
+    const unsigned char* v=NULL;
+    *lidos=0;
+    for(size_t i=0;i<n;i++){
+        size_t j=(size_t)ord[i].idx;
+        int64_t id=ids[j];
+        achado[j]=0;
+        const DeltaProd* d=delta_joias_buscar(&st->dj,id);
+        if(d){
+            if(d->op==DELTA_INS){ out[j]=d->p; achado[j]=1; k++; }
+            continue;
+        }
+        if(!st->n_jidx || id<st->jidx[0].id_base) continue;
+        size_t lo=pos, hi=st->n_jidx;
+        while(lo<hi){
+            size_t mid=(lo+hi)/2;
+            if(st->jidx[mid].id_base<=id) lo=mid+1; else hi=mid;
+        }
+        pos=lo-1;
+        size_t b=pos;
+        if(b!=bloco){
+            v=store_bloco_joias(st,b,&nreg);
+            if(!v) nreg=0;
+            bloco=b; r=0; (*lidos)++;
+        }
+        r=joia_buscar_bloco(st,v,r,nreg,id);
+        if(r<nreg && joia_id(st,v,r)==id){ joia_ler(st,v,r,&out[j]); achado[j]=1; k++; }
+    }
+    free(ord);
+    return k;
+}
+
+static size_t multiget_pedidos(Store* st, const int64_t* ids, size_t n, PedidoVar* out, unsigned char* achado){
+    ChaveIdx* ord=ordenar_chaves(ids,n);
+    size_t k=0, pos=0;
+    PedidosIdxEntry e;
+    for(size_t i=0;i<n;i++){
+        size_t j=(size_t)ord[i].idx;
+        int64_t id=ids[j];
+        achado[j]=0;
+        const DeltaPed* d=delta_pedidos_buscar(&st->dp,id);
+        if(d){
+            if(d->op!=DELTA_INS) continue;
+            out[j].id_pedido=d->p.id_pedido; out[j].n_itens=d->p.n_itens;
+            pedvar_reservar(&out[j],(size_t)d->p.n_itens);
+            if(d->p.n_itens) memcpy(out[j].ids_produtos,d->p.ids_produtos,(size_t)d->p.n_itens*sizeof(int64_t));
+            achado[j]=1; k++;
+            continue;
+        }
+        size_t lo=pos, hi=st->n_pidx, passo=1;
+        while(lo+passo<hi){
+            if(!store_pidx_entry(st,lo+passo,&e)) die("read ped.idx");
+            if(e.id_pedido>id){ hi=lo+passo; break; }
+            lo+=passo; passo*=2;
+        }
+        while(lo<hi){
+            size_t mid=(lo+hi)/2;
+            if(!store_pidx_entry(st,mid,&e)) die("read ped.idx");
+            if(e.id_pedido<=id) lo=mid+1; else hi=mid;
+        }
+        if(!lo) continue;
+        pos=lo-1;
+        if(!store_pidx_entry(st,pos,&e) || (st->passo_pidx==1 && e.id_pedido!=id)) continue;
+        if(!pedido_buscar_bloco(st,e.offset,st->passo_pidx,id,&out[j])) continue;
+        achado[j]=1; k++;
+    }
+    free(ord);
+    return k;
+}
+
+static const char* cmd_list_prod_n(Store* st, long n){
+    if(n<=0){ printf("N inválido.\n"); return "n inválido"; }
+    if(!st->joias && !st->dj.n){ printf("Não foi possível abrir %s\n", PATH_JOIAS); return "joias.dat ausente"; }
+    IterProd it; iter_prod_abrir(&it, st, &st->dj);
+    const Produto* p; long i=0; printf("Primeiros %ld produtos:\n", n);
+    while(i<n && (p=iter_prod_prox(&it))){
+        printf("%3ld) id=%lld nome=\"%.*s\" cat=\"%.*s\" marca=\"%.*s\" preco=%.2f\n",
+               i+1,(long long)p->id_produto,(int)NOME_MAX,p->nome,(int)CAT_MAX,p->categoria,(int)MARCA_MAX,p->marca,p->preco);
+        i++;
+    }
+    iter_prod_fechar(&it);
+    if(i==0) printf("(arquivo vazio)\n");
+    return NULL;
+}
+static const char* cmd_list_pedidos_n(Store* st, long n){
+    if(n<=0){ printf("N inválido.\n"); return "n inválido"; }
+    if(!st->pedidos && !st->dp.n){ printf("Não foi possível abrir %s\n", PATH_PEDIDOS); return "pedidos.dat ausente"; }
+    IterPed it; iter_ped_abrir(&it, st, &st->dp);
+    const PedidoVar* ped;
+    long printed=0;
+    while(printed<n && (ped=iter_ped_prox(&it))){
+        printf("%3ld) id_pedido=%lld  n_itens=%d\n", printed+1, (long long)ped->id_pedido, ped->n_itens);
+        printed++;
+    }
+    iter_ped_fechar(&it);
+    if(printed==0) printf("(arquivo vazio)\n");
+    return NULL;
+}
+
+static int joias_gravar(Store* st, const LayoutJoias* l, Dicionario* dic, const DeltaJoias* d, TabelaMeta* m, long* dados, size_t* pos){
+    int64_t primeiro=(d->n? d->v[0].p.id_produto : INT64_MAX);
+    char tmp[GER_CAMINHO], tmp_idx[GER_CAMINHO], path[GER_CAMINHO];
+    FILE* fout = fopen(ger_arq(tmp, "joias.tmp"), "w+b");
+    if(!fout) die("joias.tmp");
+    FILE* fidx = fopen(ger_arq(tmp_idx, "joias.idx.tmp"), "wb");
+    if(!fidx) die("joias.idx.tmp");
+    meta_iniciar(m, (uint32_t)l->fmt);
+    joias_cabecalho(fout, l, &m->checksum);
+    SecColetor sec; memset(&sec, 0, sizeof sec);
+    Zonas zonas; memset(&zonas, 0, sizeof zonas);
+    ProdutoCod ant; memset(&ant, 0, sizeof ant);
+    IterProd it; iter_prod_abrir(&it, st, d);
+    const Produto* p;
+    if(pos) *pos = 0;
+    while((p=iter_prod_prox(&it))){
+        if(p->id_produto < primeiro && pos) (*pos)++;
+        joias_idx_amostrar(fidx, l, m->n_registros, p->id_produto, fout);
+        int r = joias_escrever(fout, l, m->n_registros, dic, p, &ant, &m->checksum);
+        if(r == JOIAS_DIC_CHEIO){
+            iter_prod_fechar(&it);
+            fclose(fout); fclose(fidx);
+            remove(tmp); remove(tmp_idx);
+            sec_coletor_liberar(&sec);
+            zona_liberar(&zonas);
+            return 0;
+        }
+        if(!r){ fclose(fout); die("w produto"); }
+        zona_registrar(&zonas, m->n_registros, l->passo, p->preco);
+        meta_registro(m, p->id_produto);
+        sec_coletar(&sec, p);
+    }
+    iter_prod_fechar(&it);
+    if(dados) *dados=ftell(fout);
+    sec_gravar(&sec, m->checksum);
+    zona_gravar(&zonas, m->checksum);
+    if(l->fmt!=JOIAS_FMT_FIXO){ dic_gravar(&dic[DIC_CAT], DIC_CAT); dic_gravar(&dic[DIC_MARCA], DIC_MARCA); }
+    meta_gravar(PATH_JOIAS_META, m, fout);
+    int ok=fclose(fout)==0;
+    ok=fclose(fidx)==0 && ok;
+    if(!ok){ remove(tmp); remove(tmp_idx); die("w joias.tmp"); }
+    
+    store_soltar_joias(st);
+    if(rename(tmp, ger_arq(path, PATH_JOIAS))!=0) die("mv joias.tmp");
+    if(rename(tmp_idx, ger_arq(path, PATH_JOIAS_IDX))!=0) die("mv joias.idx.tmp");
+    return 1;
+}
+
+static size_t joias_regravar(Store* st){
+    char path[GER_CAMINHO];
+    LayoutJoias l = st->lj;
+    if(!st->joias) joias_layout(&l, JOIAS_FMT_PAG, JOIAS_PAGINAS_BLOCO);
+    TabelaMeta m;
+    size_t pos;
+    if(!joias_gravar(st, &l, st->dic, &st->dj, &m, NULL, &pos)){
+        printf("Dicionário de categoria ou marca cheio (%d valores distintos); joias.dat regravado sem codificação.\n", DIC_MAX);
+        joias_layout(&l, JOIAS_FMT_FIXO, 0);
+        joias_gravar(st, &l, st->dic, &st->dj, &m, NULL, &pos);
+        if(remove(ger_arq(path, PATH_JOIAS_CAT_DIC))!=0 && errno!=ENOENT) die("rm joias_cat.dic");
+        if(remove(ger_arq(path, PATH_JOIAS_MARCA_DIC))!=0 && errno!=ENOENT) die("rm joias_marca.dic");
+    }
+    printf("joias.idx: ok (step=%zu)\n", l.passo);
+    delta_joias_limpar(&st->dj);
+    if(remove(ger_arq(path, PATH_JOIAS_DELTA))!=0 && errno!=ENOENT) die("rm joias.delta");
+    return pos;
+}
+
+static size_t pedidos_gravar(Store* st, int fmt, const DeltaPedidos* d, Vendas* v, int recontar, TabelaMeta* m, long* dados){
+    int64_t primeiro=(d->n? d->v[0].p.id_pedido : INT64_MAX);
+    size_t passo_idx = st->pedidos_idx? st->passo_pidx : PEDIDOS_IDX_PASSO;
+    char tmp[GER_CAMINHO], tmp_idx[GER_CAMINHO], path[GER_CAMINHO];
+    FILE* fout = fopen(ger_arq(tmp, "pedidos.tmp"), "w+b");
+    if(!fout) die("pedidos.tmp");
+    FILE* fidx = fopen(ger_arq(tmp_idx, "pedidos.idx.tmp"), "wb");
+    if(!fidx) die("pedidos.idx.tmp");
+    meta_iniciar(m, (uint32_t)fmt);
+    ped_cabecalho(fout, fmt, &m->checksum);
+    pidx_cabecalho(fidx, passo_idx);
+    IterPed it; iter_ped_abrir(&it, st, d);
+    const PedidoVar* ped;
+    size_t pos = 0;
+    while((ped=iter_ped_prox(&it))){
+        if(ped->id_pedido < primeiro) pos++;
+        pidx_amostrar(fidx, passo_idx, m->n_registros, ped->id_pedido, (uint64_t)ftell(fout));
+        if(!ped_escrever(fout, fmt, ped->id_pedido, ped->n_itens, ped->ids_produtos, &m->checksum)){ fclose(fout); die("w pedido"); }
+        meta_registro(m, ped->id_pedido);
+        if(recontar) vendas_somar_pedido(v, ped, 1);
+    }
+    iter_ped_fechar(&it);
+    if(dados) *dados=ftell(fout);
+    meta_gravar(PATH_PEDIDOS_META, m, fout);
+    int ok=fclose(fout)==0;
+    ok=fclose(fidx)==0 && ok;
+    if(!ok){ remove(tmp); remove(tmp_idx); die("w pedidos.tmp"); }
+    
+    store_soltar_pedidos(st);
+    if(rename(tmp, ger_arq(path, PATH_PEDIDOS))!=0) die("mv pedidos.tmp");
+    if(rename(tmp_idx, ger_arq(path, PATH_PEDIDOS_IDX))!=0) die("mv pedidos.idx.tmp");
+    vendas_consolidar(v);
+    vendas_gravar(v, m->checksum);
+    printf("pedidos.idx: reconstruído (step=%zu).\n", passo_idx);
+    return pos;
+}
+
+static size_t pedidos_regravar(Store* st){
+    char path[GER_CAMINHO];
+    TabelaMeta m;
+    vendas_abrir(st);
+    size_t pos = pedidos_gravar(st, st->pedidos? st->fmt_pedidos : PED_FMT_VAR, &st->dp, &st->vendas, 0, &m, NULL);
+    delta_pedidos_limpar(&st->dp);
+    if(remove(ger_arq(path, PATH_PEDIDOS_DELTA))!=0 && errno!=ENOENT) die("rm pedidos.delta");
+    return pos;
+}
+
+static void compactar_tabelas(Store* st, int joias, int pedidos){
+    store_escritor(st);
+    size_t nj=(joias? st->dj.nlog : 0), np=(pedidos? st->dp.nlog : 0), pj=0, pp=0;
+    if(!nj && !np){ store_soltar_escritor(st); return; }
+    ger_iniciar(st, 1);
+    if(nj) pj=joias_regravar(st);
+    if(np) pp=pedidos_regravar(st);
+    ger_publicar(st);
+    if(nj){
+        store_recarregar_joias(st, pj);
+        printf("joias.delta: %zu operações compactadas em joias.dat.\n", nj);
+    }
+    if(np){
+        store_recarregar_pedidos(st, pp);
+        printf("pedidos.delta: %zu operações compactadas em pedidos.dat.\n", np);
+    }
+    store_soltar_escritor(st);
+}
+static void compactar_fundo(Store* st){
+    int joias=st->dj.nlog>=DELTA_LIMITE, pedidos=st->dp.nlog>=DELTA_LIMITE;
+    if(!joias && !pedidos) return;
+    if(st->compactador>0){
+        if(waitpid(st->compactador,NULL,WNOHANG)==0) return;
+        st->compactador=0;
+    }
+    fflush(NULL);
+    pid_t pid=fork();
+    if(pid<0){ compactar_tabelas(st, joias, pedidos); return; }
+    if(pid>0){
+        st->compactador=pid;
+        printf("%s atingiu %d operações; compactação iniciada em segundo plano.\n",
+               joias? PATH_JOIAS_DELTA : PATH_PEDIDOS_DELTA, DELTA_LIMITE);
+        return;
+    }
+    if(st->fd_escritor>=0) close(st->fd_escritor);
+    if(st->fd_ger>=0) close(st->fd_ger);
+    if(!freopen("/dev/null","w",stdout)) _exit(1);
+    Store filho;
+    store_abrir(&filho, POOL_BYTES, st->usar_mmap, st->busca_indice);
+    if(!filho.indisponivel) compactar_tabelas(&filho, filho.dj.nlog>=DELTA_LIMITE, filho.dp.nlog>=DELTA_LIMITE);
+    store_fechar(&filho);
+    fflush(NULL);
+    _exit(0);
+}
+
+static const char* cmd_compactar(Store* st){
+    store_escritor(st);
+    const char* erro=NULL;
+    if(!st->joias && !st->pedidos && !st->dj.nlog && !st->dp.nlog){ printf("Arquivos joias.dat e pedidos.dat não existem.\n"); erro="joias.dat e pedidos.dat ausentes"; }
+    else if(!st->dj.nlog && !st->dp.nlog) printf("Nenhuma operação pendente nos arquivos delta.\n");
+    else compactar_tabelas(st, 1, 1);
+    store_soltar_escritor(st);
+    return erro;
+}
+
+static int64_t proximo_id_produto(const Store* st){
+    int64_t id = 1;
+    if(st->meta_joias.n_registros) id = st->meta_joias.max_chave + 1;
+    if(st->dj.n && st->dj.v[st->dj.n-1].p.id_produto >= id) id = st->dj.v[st->dj.n-1].p.id_produto + 1;
+    return id;
+}
+static int64_t proximo_id_pedido(const Store* st){
+    int64_t id = 1;
+    if(st->meta_pedidos.n_registros) id = st->meta_pedidos.max_chave + 1;
+    if(st->dp.n && st->dp.v[st->dp.n-1].p.id_pedido >= id) id = st->dp.v[st->dp.n-1].p.id_pedido + 1;
+    return id;
+}
+
+static int64_t produto_inserir(Store* st, const char* s_cat, const char* s_marca, const char* s_nome, double preco){
+    store_escritor(st);
+    Produto novo;
+    memset(&novo, 0, sizeof(Produto));
+    novo.id_produto = proximo_id_produto(st);
+    safe_copy(novo.categoria, CAT_MAX, s_cat);
+    safe_copy(novo.marca, MARCA_MAX, s_marca?s_marca:"");
+    safe_copy(novo.nome, NOME_MAX, s_nome);
+    novo.preco = preco;
+    delta_registrar_produto(st, DELTA_INS, &novo);
+    delta_sincronizar(st);
+    compactar_fundo(st);
+    store_soltar_escritor(st);
+    return novo.id_produto;
+}
+static int produto_remover(Store* st, int64_t id_produto){
+    store_escritor(st);
+    Produto p;
+    int achou=buscar_produto_por_id(st, id_produto, &p);
+    if(achou){
+        delta_registrar_produto(st, DELTA_DEL, &p);
+        delta_sincronizar(st);
+        compactar_fundo(st);
+    }
+    store_soltar_escritor(st);
+    return achou;
+}
+
+static const char* cmd_add_produto(Store* st, const char* s_cat, const char* s_marca, const char* s_nome, const char* s_preco){
+    double preco;
+    if(!try_f64(s_preco,&preco) || !isfinite(preco)){
+        fprintf(stderr,"preco inválido.\n"); return "preco inválido";
+    }
+    if(!s_cat||!*s_cat||!s_nome||!*s_nome){ fprintf(stderr,"categoria e nome são obrigatórios.\n"); return "categoria e nome são obrigatórios"; }
+    
+    int64_t id_produto = produto_inserir(st, s_cat, s_marca, s_nome, preco);
+    printf("Produto %lld adicionado com sucesso.\n", (long long)id_produto);
+    return NULL;
+}
+
+static const char* cmd_remove_produto(Store* st, const char* s_id){
+    int64_t id_produto;
+    if(!try_i64(s_id,&id_produto)){ fprintf(stderr,"id_produto inválido.\n"); return "id_produto inválido"; }
+    if(!st->joias && !st->dj.n){ printf("Arquivo joias.dat não existe.\n"); return "joias.dat ausente"; }
     
-    if(remove(PATH_JOIAS)!=0) die("rm joias.dat");
-    if(rename("joias.tmp", PATH_JOIAS)!=0) die("mv joias.tmp");
-    
-    build_joias_idx();
+    if(!produto_remover(st, id_produto)){
+        printf("Produto %lld não encontrado.\n", (long long)id_produto);
+        return "produto não encontrado";
+    }
     printf("Produto %lld removido com sucesso.\n", (long long)id_produto);
+    return NULL;
 }
 
-static void cmd_add_pedido(const char* s_n_itens, const char* s_ids_produtos){
+static int32_t ler_itens_pedido(const Store* st, const char* s_n_itens, const char* s_ids_produtos, int64_t** out){
     int32_t n_itens;
     if(!try_i32(s_n_itens,&n_itens) || n_itens<=0){
-        fprintf(stderr,"n_itens inválido.\n"); return;
+        fprintf(stderr,"n_itens inválido.\n"); return -1;
     }
-    
-    int64_t id_pedido = 1;
-    FILE* ftmp = fopen(PATH_PEDIDOS, "rb");
-    if(ftmp){
-        Pedido p;
-        while(fread(&p, sizeof p, 1, ftmp)==1){
-            if(p.id_pedido >= id_pedido){
-                id_pedido = p.id_pedido + 1;
-            }
-        }
-        fclose(ftmp);
+    if(st->pedidos && st->fmt_pedidos==PED_FMT_FIXO && n_itens>MAX_ITENS_PEDIDO){
+        fprintf(stderr,"pedidos.dat está no formato fixo (max=%d itens). Converta para o formato compacto.\n", MAX_ITENS_PEDIDO);
+        return -1;
     }
     
     int64_t* ids_produtos = (int64_t*)malloc((size_t)n_itens * sizeof(int64_t));
@@ -509,120 +3410,427 @@ static void cmd_add_pedido(const char* s_n_itens, const char* s_ids_produtos){
     if(count != n_itens){
         fprintf(stderr,"Número de IDs fornecidos (%d) não corresponde a n_itens (%d).\n", count, n_itens);
         free(ids_produtos);
-        return;
+        return -1;
     }
+    *out = ids_produtos;
+    return n_itens;
+}
+static int64_t pedido_inserir(Store* st, int32_t n_itens, const int64_t* ids_produtos){
+    store_escritor(st);
+    int64_t id_pedido = proximo_id_pedido(st);
+    delta_registrar_pedido(st, DELTA_INS, id_pedido, n_itens, ids_produtos);
+    delta_sincronizar(st);
+    if(st->carregados&DER_VENDAS)
+        for(int32_t i=0;i<n_itens;i++) vendas_somar(&st->vendas, ids_produtos[i], 1);
+    compactar_fundo(st);
+    store_soltar_escritor(st);
+    return id_pedido;
+}
+static int pedido_remover(Store* st, int64_t id_pedido){
+    store_escritor(st);
+    PedidoVar ped; memset(&ped, 0, sizeof ped);
+    if(!buscar_pedido(st, id_pedido, &ped)){ pedvar_free(&ped); store_soltar_escritor(st); return 0; }
+    delta_registrar_pedido(st, DELTA_DEL, id_pedido, 0, NULL);
+    delta_sincronizar(st);
+    if(st->carregados&DER_VENDAS)
+        for(int32_t i=0;i<ped.n_itens;i++) vendas_somar(&st->vendas, ped.ids_produtos[i], -1);
+    pedvar_free(&ped);
+    compactar_fundo(st);
+    store_soltar_escritor(st);
+    return 1;
+}
+
+static const char* cmd_add_pedido(Store* st, const char* s_n_itens, const char* s_ids_produtos){
+    int64_t* ids_produtos;
+    int32_t n_itens = ler_itens_pedido(st, s_n_itens, s_ids_produtos, &ids_produtos);
+    if(n_itens<0) return "itens inválidos";
+    int64_t id_pedido = pedido_inserir(st, n_itens, ids_produtos);
+    free(ids_produtos);
+    printf("Pedido %lld adicionado com sucesso (%d itens).\n", (long long)id_pedido, n_itens);
+    return NULL;
+}
+
+static const char* cmd_remove_pedido(Store* st, const char* s_id){
+    int64_t id_pedido;
+    if(!try_i64(s_id,&id_pedido)){ fprintf(stderr,"id_pedido inválido.\n"); return "id_pedido inválido"; }
+    if(!st->pedidos && !st->dp.n){ printf("Arquivo pedidos.dat não existe.\n"); return "pedidos.dat ausente"; }
+    if(!pedido_remover(st, id_pedido)){
+        printf("Pedido %lld não encontrado.\n", (long long)id_pedido);
+        return "pedido não encontrado";
+    }
+    printf("Pedido %lld removido com sucesso.\n", (long long)id_pedido);
+    return NULL;
+}
+
+typedef struct {
+    int tabela;
+    int32_t op;
+    int64_t chave;
+    size_t linha;
+    Produto p;
+    int32_t n_itens;
+    int64_t* ids;
+    int resultado;
+} OpLote;
+
+enum { LOTE_PENDENTE=0, LOTE_INVALIDA, LOTE_INSERIDO, LOTE_REMOVIDO, LOTE_AUSENTE };
+
+typedef struct { size_t aplicadas, ausentes, invalidas; } ResumoLote;
+
+static int cmp_op_lote(const void* a, const void* b){
+    const OpLote* x=(const OpLote*)a; const OpLote* y=(const OpLote*)b;
+    if(x->tabela!=y->tabela) return x->tabela<y->tabela? -1 : 1;
+    if(x->chave!=y->chave) return x->chave<y->chave? -1 : 1;
+    return (x->linha>y->linha)-(x->linha<y->linha);
+}
+static int cmp_op_linha(const void* a, const void* b){
+    const OpLote* x=(const OpLote*)a; const OpLote* y=(const OpLote*)b;
+    return (x->linha>y->linha)-(x->linha<y->linha);
+}
+
+static int32_t ler_ids(const char* s, int64_t** out){
+    size_t cap=16; int32_t n=0;
+    int64_t* v=malloc(cap*sizeof *v); if(!v) die("malloc ids");
+    char* copia=malloc(strlen(s)+1); if(!copia) die("malloc ids");
+    strcpy(copia,s);
+    for(char* t=strtok(copia," ,;"); t; t=strtok(NULL," ,;")){
+        if(n==INT32_MAX || !try_i64(t,&v[n])){ n=-1; break; }
+        if((size_t)++n==cap){ cap*=2; v=realloc(v,cap*sizeof *v); if(!v) die("realloc ids"); }
+    }
+    free(copia);
+    if(n<=0){ free(v); v=NULL; }
+    *out=v;
+    return n;
+}
+
+static const char* cmd_lote(Store* st, const char* path, ResumoLote* r){
+    FILE* in=fopen(path,"r");
+    if(!in){ printf("Não foi possível abrir %s.\n", path); return "não foi possível abrir o arquivo de operações"; }
+    store_escritor(st);
+    size_t cap=256, n=0, nlinha=0, invalidas=0;
+    OpLote* ops=malloc(cap*sizeof *ops); if(!ops) die("malloc lote");
+    int64_t prox_prod=proximo_id_produto(st), prox_ped=proximo_id_pedido(st);
     
-    FILE* fin = fopen(PATH_PEDIDOS, "rb");
-    FILE* fout = fopen("pedidos.tmp", "wb");
-    if(!fout){ free(ids_produtos); die("pedidos.tmp"); }
-    
-    int inserted = 0;
-    if(!fin){
-        Pedido novo;
-        memset(&novo, 0, sizeof(Pedido));
-        novo.id_pedido = id_pedido;
-        novo.n_itens = n_itens;
-        for(int32_t i=0; i<n_itens; i++){
-            novo.ids_produtos[i] = ids_produtos[i];
-        }
-        if(fwrite(&novo, sizeof novo, 1, fout)!=1){ free(ids_produtos); fclose(fout); die("w pedido"); }
-        inserted = 1;
-    } else {
-        Pedido ped;
-        while(fread(&ped, sizeof ped, 1, fin)==1){
-            if(ped.id_pedido == id_pedido){
-                printf("Pedido %lld já existe. Use remove-pedido antes de adicionar novamente.\n", (long long)id_pedido);
-                fclose(fin); fclose(fout); remove("pedidos.tmp"); free(ids_produtos);
-                return;
-            }
-            
-            if(!inserted && id_pedido < ped.id_pedido){
-                Pedido novo;
-                memset(&novo, 0, sizeof(Pedido));
-                novo.id_pedido = id_pedido;
-                novo.n_itens = n_itens;
-                for(int32_t i=0; i<n_itens; i++){
-                    novo.ids_produtos[i] = ids_produtos[i];
+    char* line=NULL; size_t cap_linha=0; ssize_t tam;
+    char* cell=NULL; size_t cap_cell=0; char* col[32];
+    while((tam=getline(&line,&cap_linha,in))>=0){
+        nlinha++;
+        rstrip(line); if(!line[0] || line[0]=='#') continue;
+        if(cap_cell<2*(size_t)tam+2){
+            cap_cell=2*(size_t)tam+2;
+            free(cell); cell=malloc(cap_cell); if(!cell) die("malloc lote");
+        }
+        int nf=parse_csv_line(line,col,32,cell,cap_cell);
+        if(n==cap){ cap*=2; ops=realloc(ops,cap*sizeof *ops); if(!ops) die("realloc lote"); }
+        OpLote* o=&ops[n];
+        memset(o,0,sizeof *o);
+        o->linha=nlinha;
+        const char* tab=(nf>0? col[0]:"");
+        const char* acao=(nf>1? col[1]:"");
+        int ok=1;
+        if(strcmp(tab,"produto")==0) o->tabela=TAB_JOIAS;
+        else if(strcmp(tab,"pedido")==0) o->tabela=TAB_PEDIDOS;
+        else ok=0;
+        
+        if(ok && strcmp(acao,"remover")==0){
+            o->op=DELTA_DEL;
+            ok=(nf==3 && try_i64(col[2],&o->chave));
+        }else if(ok && strcmp(acao,"inserir")==0){
+            o->op=DELTA_INS;
+            if(o->tabela==TAB_JOIAS){
+                ok=(nf==6 && col[2][0] && col[4][0] && try_f64(col[5],&o->p.preco) && isfinite(o->p.preco));
+                if(ok){
+                    o->chave=o->p.id_produto=prox_prod++;
+                    safe_copy(o->p.categoria,CAT_MAX,col[2]);
+                    safe_copy(o->p.marca,MARCA_MAX,col[3]);
+                    safe_copy(o->p.nome,NOME_MAX,col[4]);
                 }
-                if(fwrite(&novo, sizeof novo, 1, fout)!=1){ fclose(fin); fclose(fout); free(ids_produtos); die("w novo pedido"); }
-                inserted = 1;
+            }else{
+                o->n_itens=(nf==3? ler_ids(col[2],&o->ids) : 0);
+                ok=(o->n_itens>0 && !(st->pedidos && st->fmt_pedidos==PED_FMT_FIXO && o->n_itens>MAX_ITENS_PEDIDO));
+                if(ok) o->chave=prox_ped++;
+            }
+        }else ok=0;
+        
+        if(!ok){
+            free(o->ids); o->ids=NULL;
+            o->resultado=LOTE_INVALIDA;
+            invalidas++;
+        }
+        n++;
+    }
+    free(line); free(cell);
+    fclose(in);
+    
+    qsort(ops,n,sizeof *ops,cmp_op_lote);
+    size_t aplicadas=0, ausentes=0;
+    PedidoVar ped; memset(&ped,0,sizeof ped);
+    for(size_t i=0;i<n;i++){
+        OpLote* o=&ops[i];
+        if(o->resultado==LOTE_INVALIDA) continue;
+        if(o->op==DELTA_INS){
+            if(o->tabela==TAB_JOIAS) delta_registrar_produto(st,DELTA_INS,&o->p);
+            else{
+                delta_registrar_pedido(st,DELTA_INS,o->chave,o->n_itens,o->ids);
+                if(st->carregados&DER_VENDAS)
+                    for(int32_t k=0;k<o->n_itens;k++) vendas_somar(&st->vendas,o->ids[k],1);
             }
-            
-            if(fwrite(&ped, sizeof ped, 1, fout)!=1){ fclose(fin); fclose(fout); free(ids_produtos); die("w pedido copy"); }
+            o->resultado=LOTE_INSERIDO;
+            aplicadas++;
+            continue;
         }
-        
-        if(!inserted){
-            Pedido novo;
-            memset(&novo, 0, sizeof(Pedido));
-            novo.id_pedido = id_pedido;
-            novo.n_itens = n_itens;
-            for(int32_t i=0; i<n_itens; i++){
-                novo.ids_produtos[i] = ids_produtos[i];
+        int achou;
+        if(o->tabela==TAB_JOIAS){
+            Produto p;
+            achou=buscar_produto_por_id(st,o->chave,&p);
+            if(achou) delta_registrar_produto(st,DELTA_DEL,&p);
+        }else{
+            achou=buscar_pedido(st,o->chave,&ped);
+            if(achou){
+                delta_registrar_pedido(st,DELTA_DEL,o->chave,0,NULL);
+                if(st->carregados&DER_VENDAS)
+                    for(int32_t k=0;k<ped.n_itens;k++) vendas_somar(&st->vendas,ped.ids_produtos[k],-1);
             }
-            if(fwrite(&novo, sizeof novo, 1, fout)!=1){ fclose(fout); free(ids_produtos); die("w novo pedido fim"); }
         }
-        fclose(fin);
+        o->resultado=achou? LOTE_REMOVIDO : LOTE_AUSENTE;
+        if(achou) aplicadas++; else ausentes++;
     }
-    fclose(fout);
-    free(ids_produtos);
-    
-    if(remove(PATH_PEDIDOS)!=0 && errno!=ENOENT) die("rm pedidos.dat");
-    if(rename("pedidos.tmp", PATH_PEDIDOS)!=0) die("mv pedidos.tmp");
+    pedvar_free(&ped);
+    delta_sincronizar(st);
+    qsort(ops,n,sizeof *ops,cmp_op_linha);
+    for(size_t i=0;i<n;i++){
+        const OpLote* o=&ops[i];
+        const char* nome=(o->tabela==TAB_JOIAS? "Produto" : "Pedido");
+        if(o->resultado==LOTE_INVALIDA) printf("linha %zu: operação inválida.\n", o->linha);
+        else printf("linha %zu: %s %lld %s.\n", o->linha, nome, (long long)o->chave,
+                    o->resultado==LOTE_INSERIDO? "inserido" : o->resultado==LOTE_REMOVIDO? "removido" : "não encontrado");
+        free(o->ids);
+    }
+    free(ops);
     
-    rebuild_pedidos_idx();
-    printf("Pedido %lld adicionado com sucesso (%d itens).\n", (long long)id_pedido, n_itens);
+    compactar_fundo(st);
+    printf("Lote: %zu operações aplicadas, %zu não encontradas, %zu inválidas.\n", aplicadas, ausentes, invalidas);
+    r->aplicadas=aplicadas; r->ausentes=ausentes; r->invalidas=invalidas;
+    store_soltar_escritor(st);
+    return (invalidas || ausentes)? "operações inválidas ou não encontradas no lote" : NULL;
 }
 
-static void cmd_remove_pedido(const char* s_id){
-    int64_t id_pedido;
-    if(!try_i64(s_id,&id_pedido)){ fprintf(stderr,"id_pedido inválido.\n"); return; }
-    
-    FILE* fin = fopen(PATH_PEDIDOS, "rb");
-    if(!fin){ printf("Arquivo pedidos.dat não existe.\n"); return; }
+enum { CONV_AUSENTE=0, CONV_MANTIDO, CONV_FEITO };
+
+static int cmd_converter_pedidos(Store* st){
+    store_escritor(st);
+    if(!st->pedidos){ printf("Arquivo pedidos.dat não existe.\n"); store_soltar_escritor(st); return CONV_AUSENTE; }
+    if(st->fmt_pedidos==PED_FMT_VAR){ printf("pedidos.dat já está no formato compacto.\n"); store_soltar_escritor(st); return CONV_MANTIDO; }
+    size_t antes=fsize(st->pedidos);
     
-    FILE* fout = fopen("pedidos.tmp", "wb");
-    if(!fout){ fclose(fin); die("pedidos.tmp"); }
+    ger_iniciar(st, 1);
+    Vendas base; memset(&base, 0, sizeof base);
+    DeltaPedidos vazio; memset(&vazio, 0, sizeof vazio);
+    TabelaMeta m; long depois;
+    pedidos_gravar(st, PED_FMT_VAR, &vazio, &base, 1, &m, &depois);
+    vendas_liberar(&base);
+    ger_publicar(st);
+    store_recarregar_pedidos(st, 0);
+    printf("pedidos.dat convertido para o formato compacto: %llu pedidos, %zu -> %ld bytes.\n", (unsigned long long)m.n_registros, antes, depois);
+    store_soltar_escritor(st);
+    return CONV_FEITO;
+}
+
+static int cmd_converter_joias(Store* st){
+    store_escritor(st);
+    if(!st->joias){ printf("Arquivo joias.dat não existe.\n"); store_soltar_escritor(st); return CONV_AUSENTE; }
+    if(st->lj.fmt==JOIAS_FMT_PAG || st->lj.fmt==JOIAS_FMT_CMP){ printf("joias.dat já está no formato %s.\n", st->lj.fmt==JOIAS_FMT_PAG? "paginado" : "comprimido"); store_soltar_escritor(st); return CONV_MANTIDO; }
+    size_t antes=fsize(st->joias);
     
-    Pedido ped;
-    int found = 0;
-    while(fread(&ped, sizeof ped, 1, fin)==1){
-        if(ped.id_pedido == id_pedido){
-            found = 1;
-            continue;
+    ger_iniciar(st, 1);
+    LayoutJoias l; joias_layout(&l, JOIAS_FMT_PAG, JOIAS_PAGINAS_BLOCO);
+    Dicionario dic[2]; memset(dic, 0, sizeof dic);
+    DeltaJoias vazio; memset(&vazio, 0, sizeof vazio);
+    TabelaMeta m; long depois;
+    if(!joias_gravar(st, &l, dic, &vazio, &m, &depois, NULL)){
+        dic_liberar(&dic[DIC_CAT]); dic_liberar(&dic[DIC_MARCA]);
+        ger_descartar(st);
+        printf("Dicionário de categoria ou marca cheio (%d valores distintos); joias.dat mantido no formato fixo.\n", DIC_MAX);
+        store_soltar_escritor(st);
+        return CONV_MANTIDO;
+    }
+    printf("%s: %zu valores, %s: %zu valores.\n", PATH_JOIAS_CAT_DIC, dic[DIC_CAT].n, PATH_JOIAS_MARCA_DIC, dic[DIC_MARCA].n);
+    dic_liberar(&dic[DIC_CAT]); dic_liberar(&dic[DIC_MARCA]);
+    ger_publicar(st);
+    store_recarregar_joias(st, 0);
+    printf("joias.dat convertido para o formato paginado (blocos de %u páginas): %llu produtos, %zu -> %ld bytes.\n", l.paginas, (unsigned long long)m.n_registros, antes, depois);
+    store_soltar_escritor(st);
+    return CONV_FEITO;
+}
+
+typedef struct { double max; size_t bloco; } OrdemZona;
+
+static int cmp_ordem_zona(const void* a, const void* b){
+    const OrdemZona* x=a; const OrdemZona* y=b;
+    int nx=isnan(x->max)!=0, ny=isnan(y->max)!=0;
+    if(nx!=ny) return nx? -1 : 1;
+    if(!nx && x->max!=y->max) return x->max>y->max? -1 : 1;
+    return (x->bloco>y->bloco)-(x->bloco<y->bloco);
+}
+static int produto_antes(const Produto* a, const Produto* b){
+    if(isnan(a->preco) || isnan(b->preco)) return !isnan(a->preco);
+    return a->preco>b->preco || (a->preco==b->preco && a->id_produto<b->id_produto);
+}
+static void topk_inserir(Produto* h, size_t* n, size_t k, const Produto* p){
+    if(isnan(p->preco)) return;
+    if(*n==k && !produto_antes(p,&h[0])) return;
+    size_t i;
+    if(*n<k) i=(*n)++;
+    else{
+        Produto ult=h[--(*n)];
+        for(i=0;;){
+            size_t l=2*i+1, r=l+1, x=i;
+            const Produto* menor=&ult;
+            if(l<*n && produto_antes(menor,&h[l])){ x=l; menor=&h[l]; }
+            if(r<*n && produto_antes(menor,&h[r])) x=r;
+            if(x==i) break;
+            h[i]=h[x]; i=x;
         }
-        
-        if(fwrite(&ped, sizeof ped, 1, fout)!=1){ fclose(fin); fclose(fout); die("w pedido"); }
+        h[i]=ult;
+        i=(*n)++;
     }
-    fclose(fin);
-    fclose(fout);
-    
-    if(!found){
-        printf("Pedido %lld não encontrado.\n", (long long)id_pedido);
-        remove("pedidos.tmp");
-        return;
+    while(i>0 && produto_antes(&h[(i-1)/2],p)){ h[i]=h[(i-1)/2]; i=(i-1)/2; }
+    h[i]=*p;
+}
+static int cmp_produto_topk(const void* a, const void* b){
+    const Produto* x=a; const Produto* y=b;
+    return produto_antes(x,y)? -1 : produto_antes(y,x)? 1 : 0;
+}
+
+typedef struct { Produto h[TOPK_MAX]; size_t n, k, lidos; } AccTopK;
+
+static int topk_aceitar(void* acc, const Store* st, size_t bloco){
+    AccTopK* a=acc;
+    return a->n<a->k || !(st->zonas.v[bloco].max<a->h[0].preco);
+}
+static void topk_bloco(void* acc, const Store* st, const unsigned char* v, size_t n){
+    AccTopK* a=acc;
+    a->lidos++;
+    for(size_t r=0;r<n;r++){
+        double preco=joia_preco(st,v,r);
+        if(isnan(preco) || (a->n==a->k && preco<a->h[0].preco)) continue;
+        if(delta_joias_buscar(&st->dj,joia_id(st,v,r))) continue;
+        Produto p; joia_ler(st,v,r,&p);
+        topk_inserir(a->h,&a->n,a->k,&p);
     }
-    
-    if(remove(PATH_PEDIDOS)!=0) die("rm pedidos.dat");
-    if(rename("pedidos.tmp", PATH_PEDIDOS)!=0) die("mv pedidos.tmp");
-    
-    rebuild_pedidos_idx();
-    printf("Pedido %lld removido com sucesso.\n", (long long)id_pedido);
 }
 
-static void q_joia_mais_cara(void){
-    FILE* f=fopen(PATH_JOIAS,"rb"); if(!f){ printf("Abra primeiro com import.\n"); return; }
-    Produto best; int ok=0;
-    Produto p;
-    while(fread(&p,sizeof p,1,f)==1){
-        if(!ok || p.preco>best.preco){ best=p; ok=1; }
+static size_t joias_topk(Store* st, size_t k, Produto* h, size_t* lidos){
+    zona_abrir(st);
+    size_t n=0, nb=st->zonas.n, nl=0;
+    OrdemZona* ord=malloc((nb? nb:1)*sizeof *ord); size_t* blocos=malloc((nb? nb:1)*sizeof *blocos);
+    if(!ord || !blocos) die("malloc top-k");
+    for(size_t b=0;b<nb;b++){ ord[b].max=st->zonas.v[b].max; ord[b].bloco=b; }
+    qsort(ord,nb,sizeof *ord,cmp_ordem_zona);
+    for(size_t b=0;b<nb;b++) blocos[b]=ord[b].bloco;
+    free(ord);
+    int nt=scan_threads(nb*st->lj.passo);
+    AccTopK* parc=calloc((size_t)nt,sizeof *parc); if(!parc) die("malloc top-k");
+    for(int t=0;t<nt;t++) parc[t].k=k;
+    if(nb && st->joias) varredura_executar(st, TAB_JOIAS, blocos, nb, nt, parc, sizeof *parc, topk_aceitar, topk_bloco, NULL);
+    for(int t=0;t<nt;t++){
+        for(size_t i=0;i<parc[t].n;i++) topk_inserir(h,&n,k,&parc[t].h[i]);
+        nl+=parc[t].lidos;
     }
-    fclose(f);
-    if(ok){
+    free(parc); free(blocos);
+    if(lidos) *lidos=nl;
+    for(size_t i=0;i<st->dj.n;i++)
+        if(st->dj.v[i].op==DELTA_INS) topk_inserir(h,&n,k,&st->dj.v[i].p);
+    qsort(h,n,sizeof *h,cmp_produto_topk);
+    return n;
+}
+
+static const char* q_joias_mais_caras(Store* st, const char* s_k){
+    long k=strtol(s_k,NULL,10);
+    if(k<=0 || k>TOPK_MAX){ printf("K inválido (1 a %d).\n", TOPK_MAX); return "k inválido"; }
+    if(!st->joias && !st->dj.n){ printf("Abra primeiro com import.\n"); return "joias.dat ausente"; }
+    if(!st->meta_joias.n_registros && !st->dj.n){ printf("joias.dat vazio.\n"); return "joias.dat vazio"; }
+    Produto h[TOPK_MAX];
+    size_t n=joias_topk(st,(size_t)k,h,NULL);
+    if(n==0){ printf("joias.dat vazio.\n"); return "joias.dat vazio"; }
+    if(k==1){
         printf("Joia mais cara: id=%lld nome=\"%.*s\" cat=\"%.*s\" marca=\"%.*s\" preco=%.2f\n",
-            (long long)best.id_produto, (int)NOME_MAX, best.nome, (int)CAT_MAX, best.categoria, (int)MARCA_MAX, best.marca, best.preco);
+            (long long)h[0].id_produto, (int)NOME_MAX, h[0].nome, (int)CAT_MAX, h[0].categoria, (int)MARCA_MAX, h[0].marca, h[0].preco);
     }else{
-        printf("joias.dat vazio.\n");
+        printf("%zu joias mais caras:\n", n);
+        for(size_t i=0;i<n;i++)
+            printf("%3zu) id=%lld nome=\"%.*s\" cat=\"%.*s\" marca=\"%.*s\" preco=%.2f\n",
+                i+1,(long long)h[i].id_produto,(int)NOME_MAX,h[i].nome,(int)CAT_MAX,h[i].categoria,(int)MARCA_MAX,h[i].marca,h[i].preco);
+    }
+    return NULL;
+}
+
+static int cmp_produto_registro(const void* a, const void* b){
+    const Produto* x=a; const Produto* y=b;
+    return (x->id_produto>y->id_produto)-(x->id_produto<y->id_produto);
+}
+
+typedef struct { Produto lista[SEC_LISTA_MAX]; size_t nl, n; double lo, hi; } AccFaixa;
+
+static void faixa_bloco(void* acc, const Store* st, const unsigned char* v, size_t n){
+    AccFaixa* a=acc;
+    for(size_t r=0;r<n;r++){
+        double preco=joia_preco(st,v,r);
+        if(!(preco>=a->lo && preco<=a->hi) || delta_joias_buscar(&st->dj,joia_id(st,v,r))) continue;
+        if(a->nl<SEC_LISTA_MAX) joia_ler(st,v,r,&a->lista[a->nl++]);
+        a->n++;
+    }
+}
+
+static size_t joias_faixa(Store* st, double lo, double hi, Produto* saida, size_t* nsaida, size_t* lidos){
+    *nsaida=0;
+    if(lidos) *lidos=0;
+    if(!isfinite(lo) || !isfinite(hi) || lo>hi) return 0;
+    zona_abrir(st);
+    size_t* blocos=malloc((st->zonas.n? st->zonas.n:1)*sizeof *blocos); if(!blocos) die("malloc faixa");
+    size_t nb=0;
+    for(size_t b=0;b<st->zonas.n;b++)
+        if(!(st->zonas.v[b].max<lo || st->zonas.v[b].min>hi)) blocos[nb++]=b;
+    int nt=scan_threads(nb*st->lj.passo);
+    AccFaixa* parc=calloc((size_t)nt,sizeof *parc); if(!parc) die("malloc faixa");
+    for(int t=0;t<nt;t++){ parc[t].lo=lo; parc[t].hi=hi; }
+    if(nb && st->joias) varredura_executar(st, TAB_JOIAS, blocos, nb, nt, parc, sizeof *parc, NULL, faixa_bloco, NULL);
+    Produto* lista=malloc(((size_t)nt+1)*SEC_LISTA_MAX*sizeof *lista); if(!lista) die("malloc faixa");
+    size_t n=0, nl=0;
+    for(int t=0;t<nt;t++){
+        memcpy(&lista[nl],parc[t].lista,parc[t].nl*sizeof *lista);
+        nl+=parc[t].nl; n+=parc[t].n;
+    }
+    free(parc); free(blocos);
+    qsort(lista,nl,sizeof *lista,cmp_produto_registro);
+    if(nl>SEC_LISTA_MAX) nl=SEC_LISTA_MAX;
+    size_t nbase=nl;
+    for(size_t i=0;i<st->dj.n;i++){
+        const Produto* p=&st->dj.v[i].p;
+        if(st->dj.v[i].op!=DELTA_INS || !(p->preco>=lo && p->preco<=hi)) continue;
+        if(nl<nbase+SEC_LISTA_MAX) lista[nl++]=*p;
+        n++;
     }
+    qsort(lista,nl,sizeof *lista,cmp_produto_registro);
+    *nsaida=nl<SEC_LISTA_MAX? nl : SEC_LISTA_MAX;
+    memcpy(saida,lista,*nsaida*sizeof *lista);
+    free(lista);
+    if(lidos) *lidos=nb;
+    return n;
+}
+
+static const char* q_joias_faixa_preco(Store* st, const char* s_min, const char* s_max){
+    double lo, hi;
+    if(!try_f64(s_min,&lo) || !try_f64(s_max,&hi) || !isfinite(lo) || !isfinite(hi) || lo>hi){ printf("Faixa de preço inválida.\n"); return "faixa de preço inválida"; }
+    if(!st->joias && !st->dj.n){ printf("Abra primeiro com import.\n"); return "joias.dat ausente"; }
+    Produto lista[SEC_LISTA_MAX];
+    size_t nl, n=joias_faixa(st,lo,hi,lista,&nl,NULL);
+    printf("%zu produtos com preco entre %.2f e %.2f:\n", n, lo, hi);
+    for(size_t i=0;i<nl;i++)
+        printf("%3zu) id=%lld nome=\"%.*s\" cat=\"%.*s\" marca=\"%.*s\" preco=%.2f\n",
+               i+1,(long long)lista[i].id_produto,(int)NOME_MAX,lista[i].nome,(int)CAT_MAX,lista[i].categoria,(int)MARCA_MAX,lista[i].marca,lista[i].preco);
+    if(n>SEC_LISTA_MAX) printf("... (mais %zu)\n", n-SEC_LISTA_MAX);
+    return NULL;
 }
 
 static int equals_ignore_case(const char* a, const char* b){
@@ -634,131 +3842,264 @@ static int equals_ignore_case(const char* a, const char* b){
     return *a=='\0' && *b=='\0';
 }
 
-static int buscar_produto_por_id(int64_t id_produto, Produto* resultado) {
-    FILE* fidx = fopen(PATH_JOIAS_IDX, "rb");
-    FILE* fdat = fopen(PATH_JOIAS, "rb");
-    if (!fidx || !fdat) {
-        if (fidx) fclose(fidx);
-        if (fdat) fclose(fdat);
-        return 0;
+static int has_category(const char* cat_full, const char* want_clean){
+    const char* base = (strncmp(cat_full,"jewelry.",8)==0? cat_full+8 : cat_full);
+    while(*base && *want_clean){
+        char a=(char)tolower((unsigned char)*base);
+        char b=(char)tolower((unsigned char)*want_clean);
+        if(a!=b) return 0;
+        base++; want_clean++;
     }
-    
-    size_t n = fsize(fidx) / sizeof(JoiasIdxEntry);
-    if (n == 0) {
-        fclose(fidx);
-        fclose(fdat);
-        return 0;
+    return *base=='\0' && *want_clean=='\0';
+}
+
+static int pred_nome(const Produto* p, const char* termo){ return equals_ignore_case(p->nome, termo); }
+static int pred_categoria(const Produto* p, const char* termo){ return has_category(p->categoria, termo); }
+
+static unsigned char* categoria_codigos(const Store* st, const char* termo){
+    const Dicionario* d=&st->dic[DIC_CAT];
+    unsigned char* cods=calloc(d->n? d->n:1,1); if(!cods) die("malloc categoria");
+    for(size_t c=0;c<d->n;c++){
+        char valor[DIC_VALOR+1];
+        memcpy(valor,d->v[c],DIC_VALOR); valor[DIC_VALOR]='\0';
+        cods[c]=(unsigned char)has_category(valor,termo);
     }
-    
-    size_t lo = 0, hi = n;
-    while (lo < hi) {
-        size_t mid = (lo + hi) / 2;
-        JoiasIdxEntry entry;
-        if (fseek(fidx, (long)(mid * sizeof(JoiasIdxEntry)), SEEK_SET) != 0) {
-            fclose(fidx); fclose(fdat);
-            return 0;
-        }
-        if (fread(&entry, sizeof(JoiasIdxEntry), 1, fidx) != 1) {
-            fclose(fidx); fclose(fdat);
-            return 0;
-        }
-        if (entry.id_base <= id_produto)
-            lo = mid + 1;
-        else
-            hi = mid;
+    return cods;
+}
+
+static int cmp_i64(const void* a, const void* b){
+    int64_t x=*(const int64_t*)a, y=*(const int64_t*)b;
+    return (x>y)-(x<y);
+}
+
+static int64_t* sec_consultar(Store* st, int campo, const char* termo, size_t* n){
+    *n=0;
+    if(strlen(termo)>=NOME_MAX){
+        int64_t* v=malloc(sizeof *v); if(!v) die("malloc consulta indice");
+        return v;
     }
-    size_t base = (lo == 0 ? 0 : lo - 1);
-    
-    JoiasIdxEntry entry;
-    if (fseek(fidx, (long)(base * sizeof(JoiasIdxEntry)), SEEK_SET) != 0) {
-        fclose(fidx); fclose(fdat);
-        return 0;
+    char chave[NOME_MAX];
+    sec_normalizar(chave, termo);
+    sec_abrir(st);
+    const SecIdx* s=&st->sec[campo];
+    const SecDirEntry* e=NULL;
+    size_t lo=0, hi=s->n_chaves;
+    while(lo<hi){
+        size_t mid=(lo+hi)/2;
+        int c=strncmp(s->dir[mid].chave,chave,NOME_MAX);
+        if(c==0){ e=&s->dir[mid]; break; }
+        if(c<0) lo=mid+1; else hi=mid;
     }
-    if (fread(&entry, sizeof(JoiasIdxEntry), 1, fidx) != 1) {
-        fclose(fidx); fclose(fdat);
-        return 0;
+    size_t cap=(e? (size_t)e->n : 0)+16, k=0;
+    int64_t* v=malloc(cap*sizeof *v); if(!v) die("malloc consulta indice");
+    for(size_t i=0; e && i<e->n; i++){
+        int64_t id=s->ids[e->ini+i];
+        if(!delta_joias_buscar(&st->dj,id)) v[k++]=id;
     }
-    
-    if (fseek(fdat, (long)entry.offset, SEEK_SET) != 0) {
-        fclose(fidx); fclose(fdat);
-        return 0;
+    unsigned char* cods=(campo==SEC_CAT? categoria_codigos(st,chave) : NULL);
+    size_t base=k;
+    for(size_t i=0;i<st->dj.n;i++){
+        const DeltaProd* d=&st->dj.v[i];
+        if(d->op!=DELTA_INS) continue;
+        if(campo==SEC_NOME){ if(!pred_nome(&d->p,chave)) continue; }
+        else if(d->cod_categoria<st->dic[DIC_CAT].n){ if(!cods[d->cod_categoria]) continue; }
+        else if(!pred_categoria(&d->p,chave)) continue;
+        if(k==cap){ cap*=2; v=realloc(v,cap*sizeof *v); if(!v) die("realloc consulta indice"); }
+        v[k++]=d->p.id_produto;
     }
-    
+    free(cods);
+    if(k>base) qsort(v,k,sizeof *v,cmp_i64);
+    *n=k;
+    return v;
+}
+
+static int sec_campo(const char* s_campo){
+    if(equals_ignore_case(s_campo,"nome")) return SEC_NOME;
+    if(equals_ignore_case(s_campo,"categoria")) return SEC_CAT;
+    return -1;
+}
+
+static const char* cmd_buscar_indice(Store* st, const char* s_campo, const char* termo){
+    int campo=sec_campo(s_campo);
+    if(campo<0){ printf("Campo inválido (use nome ou categoria).\n"); return "campo inválido (use nome ou categoria)"; }
+    if(!st->joias && !st->dj.n){ printf("Não foi possível abrir %s\n", PATH_JOIAS); return "joias.dat ausente"; }
+    size_t n;
+    int64_t* ids=sec_consultar(st,campo,termo,&n);
+    printf("%zu produtos com %s \"%s\" (%s):\n", n, campo==SEC_NOME? "nome":"categoria", termo, sec_path(campo));
     Produto p;
-    size_t cnt = 0;
-    while (cnt < JOIAS_INDEX_STEP && fread(&p, sizeof p, 1, fdat) == 1) {
-        if (p.id_produto == id_produto) {
-            *resultado = p;
-            fclose(fidx);
-            fclose(fdat);
-            return 1;
+    for(size_t i=0;i<n && i<SEC_LISTA_MAX;i++){
+        if(!buscar_produto_por_id(st,ids[i],&p)) continue;
+        printf("%3zu) id=%lld nome=\"%.*s\" cat=\"%.*s\" marca=\"%.*s\" preco=%.2f\n",
+               i+1,(long long)p.id_produto,(int)NOME_MAX,p.nome,(int)CAT_MAX,p.categoria,(int)MARCA_MAX,p.marca,p.preco);
+    }
+    if(n>SEC_LISTA_MAX) printf("... (mais %zu)\n", n-SEC_LISTA_MAX);
+    free(ids);
+    return NULL;
+}
+
+static const char* cmd_multiget(Store* st, const char* s_tabela, const char* s_ids){
+    int pedidos;
+    if(equals_ignore_case(s_tabela,"produto")) pedidos=0;
+    else if(equals_ignore_case(s_tabela,"pedido")) pedidos=1;
+    else{ printf("Tabela inválida (use produto ou pedido).\n"); return "tabela inválida (use produto ou pedido)"; }
+    if(store_exigir(st,pedidos? USO_PEDIDOS : USO_JOIAS)) return st->erro;
+    int64_t* ids;
+    int32_t n=ler_ids(s_ids,&ids);
+    if(n<=0){ fprintf(stderr,"Lista de IDs inválida.\n"); return "lista de IDs inválida"; }
+    unsigned char* achado=malloc((size_t)n); if(!achado) die("malloc multiget");
+    size_t k;
+    if(!pedidos){
+        Produto* v=malloc((size_t)n*sizeof *v); if(!v) die("malloc multiget");
+        size_t lidos;
+        k=multiget_produtos(st,ids,(size_t)n,v,achado,&lidos);
+        for(int32_t i=0;i<n;i++){
+            if(achado[i]) printf("Produto: id=%lld nome=\"%.*s\" cat=\"%.*s\" marca=\"%.*s\" preco=%.2f\n",
+                                 (long long)v[i].id_produto, (int)NOME_MAX, v[i].nome, (int)CAT_MAX, v[i].categoria, (int)MARCA_MAX, v[i].marca, v[i].preco);
+            else printf("Produto %lld não encontrado.\n", (long long)ids[i]);
+        }
+        printf("%zu de %d produtos encontrados (%zu blocos lidos).\n", k, n, lidos);
+        free(v);
+    }else{
+        PedidoVar* v=calloc((size_t)n,sizeof *v); if(!v) die("malloc multiget");
+        k=multiget_pedidos(st,ids,(size_t)n,v,achado);
+        for(int32_t i=0;i<n;i++){
+            if(!achado[i]){ printf("Pedido %lld não encontrado.\n", (long long)ids[i]); continue; }
+            printf("Pedido %lld — n_itens=%d\n", (long long)v[i].id_pedido, v[i].n_itens);
+            for(int32_t t=0;t<v[i].n_itens;t++) printf("  item%03d -> id_produto=%lld\n", t+1, (long long)v[i].ids_produtos[t]);
         }
-        cnt++;
+        printf("%zu de %d pedidos encontrados.\n", k, n);
+        for(int32_t i=0;i<n;i++) pedvar_free(&v[i]);
+        free(v);
     }
-    
-    fclose(fidx);
-    fclose(fdat);
+    free(achado); free(ids);
+    return k<(size_t)n? "ids não encontrados" : NULL;
+}
+
+typedef struct { int64_t* chaves; unsigned char* usado; size_t cap, n; } ConjIds;
+
+static void conj_init(ConjIds* c, size_t n_esperado){
+    size_t cap=16; while(cap < n_esperado*2) cap<<=1;
+    c->chaves=malloc(cap*sizeof *c->chaves); c->usado=calloc(cap,1);
+    if(!c->chaves||!c->usado) die("malloc conj");
+    c->cap=cap; c->n=0;
+}
+static void conj_free(ConjIds* c){
+    free(c->chaves); free(c->usado);
+    c->chaves=NULL; c->usado=NULL; c->cap=c->n=0;
+}
+static void conj_add(ConjIds* c, int64_t id);
+static void conj_grow(ConjIds* c){
+    ConjIds novo; conj_init(&novo, c->cap);
+    for(size_t i=0;i<c->cap;i++) if(c->usado[i]) conj_add(&novo, c->chaves[i]);
+    conj_free(c); *c=novo;
+}
+static void conj_add(ConjIds* c, int64_t id){
+    if((c->n+1)*2 > c->cap) conj_grow(c);
+    size_t m=c->cap-1, i=(size_t)hash_id(id)&m;
+    while(c->usado[i]){ if(c->chaves[i]==id) return; i=(i+1)&m; }
+    c->usado[i]=1; c->chaves[i]=id; c->n++;
+}
+static int conj_tem(const ConjIds* c, int64_t id){
+    size_t m=c->cap-1, i=(size_t)hash_id(id)&m;
+    while(c->usado[i]){ if(c->chaves[i]==id) return 1; i=(i+1)&m; }
     return 0;
 }
 
-static void q_vendas_por_nome(const char* nome){
-    if(!nome||!*nome){ printf("Forneça um nome.\n"); return; }
-    
-    FILE* fp=fopen(PATH_PEDIDOS,"rb"); 
-    if(!fp){ printf("Precisa do pedidos.dat (rode import).\n"); return; }
-    
+static long long join_vendas(const int64_t* ids, size_t nids, const Vendas* a){
     long long count=0;
-    Pedido ped;
-    
-    while(fread(&ped,sizeof ped,1,fp)==1){
-        for(int32_t i=0;i<ped.n_itens;i++){
-            Produto p;
-            
-            if(buscar_produto_por_id(ped.ids_produtos[i], &p)){
-                if(equals_ignore_case(p.nome,nome)){
-                    count++;
-                }
-            }
-        }
+    size_t log_n=1; while(((size_t)1<<log_n) < a->n) log_n++;
+    if(nids*log_n < a->n){
+        for(size_t i=0;i<nids;i++) count+=vendas_unidades(a,ids[i]);
+        return count;
     }
-    fclose(fp);
-    printf("Vendas (itens) do nome \"%s\": %lld\n", nome, count);
+    ConjIds c; conj_init(&c,nids);
+    for(size_t i=0;i<nids;i++) conj_add(&c,ids[i]);
+    if(c.n>0)
+        for(size_t i=0;i<a->n;i++) if(conj_tem(&c,a->v[i].id_produto)) count+=a->v[i].unidades;
+    conj_free(&c);
+    return count;
 }
 
+static long long contar_vendas(Store* st, int campo, const char* termo){
+    if(!st->pedidos && !st->dp.n) return -1;
+    size_t n;
+    int64_t* ids=sec_consultar(st,campo,termo,&n);
+    vendas_abrir(st);
+    vendas_consolidar(&st->vendas);
+    long long count=join_vendas(ids,n,&st->vendas);
+    free(ids);
+    return count;
+}
 
-static int has_category(const char* cat_full, const char* want_clean){
-    const char* base = (strncmp(cat_full,"jewelry.",8)==0? cat_full+8 : cat_full);
-    while(*base && *want_clean){
-        char a=(char)tolower((unsigned char)*base);
-        char b=(char)tolower((unsigned char)*want_clean);
-        if(a!=b) return 0;
-        base++; want_clean++;
+typedef struct { int regravado; size_t produtos, divergentes; long long unidades; } ResumoVendas;
+
+static const char* cmd_verificar_vendas(Store* st, ResumoVendas* r){
+    if(!st->pedidos && !st->dp.n){ printf("Arquivo pedidos.dat não existe.\n"); return "pedidos.dat ausente"; }
+    Vendas arq, novo;
+    VendasCab cab;
+    int ok=vendas_ler(&arq,&cab);
+    if(!ok) printf("%s: ausente ou corrompido.\n", PATH_VENDAS_AGG);
+    else if(cab.checksum!=st->meta_pedidos.checksum){
+        printf("%s: não corresponde ao pedidos.dat atual.\n", PATH_VENDAS_AGG);
+        ok=0;
     }
-    return *base=='\0' && *want_clean=='\0';
+    vendas_recalcular(st,&novo);
+    size_t i=0, j=0, difs=0;
+    long long total=0;
+    while(i<arq.n || j<novo.n){
+        int64_t id; int64_t a=0, b=0;
+        if(j==novo.n || (i<arq.n && arq.v[i].id_produto<novo.v[j].id_produto)){ id=arq.v[i].id_produto; a=arq.v[i++].unidades; }
+        else if(i==arq.n || novo.v[j].id_produto<arq.v[i].id_produto){ id=novo.v[j].id_produto; b=novo.v[j++].unidades; }
+        else{ id=arq.v[i].id_produto; a=arq.v[i++].unidades; b=novo.v[j++].unidades; }
+        total+=b;
+        if(a==b) continue;
+        if(difs<VENDAS_DIFS_MAX) printf("produto %lld: arquivo=%lld recalculado=%lld\n", (long long)id, (long long)a, (long long)b);
+        difs++;
+    }
+    vendas_liberar(&arq);
+    if(ok && !difs){
+        printf("%s: OK (%zu produtos, %lld unidades no pedidos.dat).\n", PATH_VENDAS_AGG, novo.n, total);
+        r->regravado=0; r->produtos=novo.n; r->divergentes=0; r->unidades=total;
+        vendas_liberar(&novo);
+        return NULL;
+    }
+    if(difs) printf("%zu produtos divergentes.\n", difs);
+    uint64_t ger=st->ger;
+    store_escritor(st);
+    if(st->ger!=ger){
+        vendas_liberar(&novo);
+        vendas_recalcular(st,&novo);
+        total=0;
+        for(size_t k=0;k<novo.n;k++) total+=novo.v[k].unidades;
+    }
+    vendas_gravar(&novo, st->meta_pedidos.checksum);
+    printf("%s: regravado a partir dos pedidos (%zu produtos, %lld unidades).\n", PATH_VENDAS_AGG, novo.n, total);
+    r->regravado=1; r->produtos=novo.n; r->divergentes=difs; r->unidades=total;
+    vendas_liberar(&st->vendas);
+    st->vendas=novo;
+    st->derivados&=~DER_VENDAS;
+    st->carregados|=DER_VENDAS;
+    vendas_aplicar_delta(st, &st->vendas, 1);
+    store_soltar_escritor(st);
+    return NULL;
 }
 
-static void q_vendas_por_categoria(const char* categoria){
-    if(!categoria||!*categoria){ printf("Forneça a categoria (ex: earring, pendant, necklace).\n"); return; }
-    
-    FILE* fp=fopen(PATH_PEDIDOS,"rb"); 
-    if(!fp){ printf("Precisa do pedidos.dat (rode import).\n"); return; }
+static const char* q_vendas_por_nome(Store* st, const char* nome){
+    if(!nome||!*nome){ printf("Forneça um nome.\n"); return "nome vazio"; }
     
-    long long count=0;
-    Pedido ped;
+    long long count=contar_vendas(st, SEC_NOME, nome);
+    if(count<0){ printf("Precisa do pedidos.dat (rode import).\n"); return "pedidos.dat ausente"; }
+    printf("Vendas (itens) do nome \"%s\": %lld\n", nome, count);
+    return NULL;
+}
+
+static const char* q_vendas_por_categoria(Store* st, const char* categoria){
+    if(!categoria||!*categoria){ printf("Forneça a categoria (ex: earring, pendant, necklace).\n"); return "categoria vazia"; }
     
-    while(fread(&ped,sizeof ped,1,fp)==1){
-        for(int32_t i=0;i<ped.n_itens;i++){
-            Produto p;
-            
-            if(buscar_produto_por_id(ped.ids_produtos[i], &p)){
-                if(has_category(p.categoria, categoria)){
-                    count++;
-                }
-            }
-        }
-    }
-    fclose(fp);
+    long long count=contar_vendas(st, SEC_CAT, categoria);
+    if(count<0){ printf("Precisa do pedidos.dat (rode import).\n"); return "pedidos.dat ausente"; }
     printf("Total de itens vendidos na categoria \"%s\": %lld\n", categoria, count);
+    return NULL;
 }
 
 static void rstrip2(char *s){ size_t n=strlen(s); while(n>0 && (s[n-1]=='\n'||s[n-1]=='\r')) s[--n]='\0'; }
@@ -779,7 +4120,335 @@ static void press_enter(void){
     int c; while((c=getchar())!='\n' && c!=EOF);
 }
 
-static void menu_loop(void){
+static void cmd_stats_pool(Store* st){
+    BufPool* bp=&st->pool;
+    unsigned long long tot=bp->hits+bp->misses;
+    printf("Leitura: %s\n", !st->usar_mmap? "buffer pool" : st->lj.fmt==JOIAS_FMT_CMP? "mmap (pool guarda só os blocos de produtos descomprimidos)" : "mmap (buscas direto no mapeamento, sem passar pelo pool)");
+    printf("Buffer pool: %zu quadros, %zu/%zu bytes\n", bp->nquadros, bp->bytes, bp->cap_bytes);
+    printf("  hits=%llu misses=%llu taxa=%.1f%%\n", bp->hits, bp->misses, tot? 100.0*(double)bp->hits/(double)tot : 0.0);
+    if(st->usar_mmap) printf("  acessos diretos ao mapeamento=%llu\n", bp->diretos);
+    printf("Geração: %llu (%s)\n", (unsigned long long)st->ger, ger_dir[0]? ger_dir : "diretório atual");
+}
+
+static double agora(void){
+    struct timespec t; clock_gettime(CLOCK_MONOTONIC,&t);
+    return (double)t.tv_sec+(double)t.tv_nsec*1e-9;
+}
+
+static const char* cmd_bench_ordenacao(const char* s_n){
+    int64_t n64;
+    if(!try_i64(s_n,&n64) || n64<=0){ printf("Quantidade invalida.\n"); return "quantidade inválida"; }
+    size_t nL=(size_t)n64, nP=(nL/4? nL/4 : 1);
+
+    LinhaTmp* l=malloc(nL*sizeof *l); LinhaTmp* lq=malloc(nL*sizeof *lq); LinhaTmp* lr=malloc(nL*sizeof *lr);
+    if(!l || !lq || !lr) die("malloc bench");
+    for(size_t i=0;i<nL;i++){
+        l[i].id_pedido=(int64_t)(hash_id((int64_t)i)%(nL/3+1));
+        l[i].id_produto=(int64_t)(hash_id((int64_t)(i+nL))%(nP+1));
+        l[i].quantidade=1;
+    }
+    memcpy(lq,l,nL*sizeof *l);
+    double t0=agora();
+    qsort(lq,nL,sizeof *lq,cmp_linha_by_pedido_then_prod);
+    double t1=agora();
+    ChaveIdx* ord=ordenar_linhas(l,nL);
+    double tr=agora();
+    for(size_t i=0;i<nL;i++) lr[i]=l[ord[i].idx];
+    double t2=agora();
+    int ok=1;
+    for(size_t i=0;i<nL;i++) if(cmp_linha_by_pedido_then_prod(&lq[i],&lr[i])!=0){ ok=0; break; }
+    printf("Linhas de pedido (%zu): qsort %.3f s, radix %.3f s + copia %.3f s (%.1fx) %s\n", nL, t1-t0, tr-t1, t2-tr, (t2>t1)? (t1-t0)/(t2-t1) : 0.0, ok? "ordem igual" : "ORDEM DIFERENTE");
+    free(ord); free(l); free(lq); free(lr);
+
+    ProdutoTmp* p=malloc(nP*sizeof *p); ProdutoTmp* pq=malloc(nP*sizeof *pq); ProdutoTmp* pr=malloc(nP*sizeof *pr);
+    if(!p || !pq || !pr) die("malloc bench");
+    for(size_t i=0;i<nP;i++){
+        memset(&p[i],0,sizeof p[i]);
+        p[i].id_produto=(int64_t)(hash_id((int64_t)i)%(nP/2+1));
+        snprintf(p[i].nome,NOME_MAX,"produto %zu",i);
+        p[i].preco=(double)(i%1000);
+    }
+    memcpy(pq,p,nP*sizeof *p);
+    t0=agora();
+    qsort(pq,nP,sizeof *pq,cmp_produto_id);
+    t1=agora();
+    ord=ordenar_produtos(p,nP);
+    tr=agora();
+    for(size_t i=0;i<nP;i++) pr[i]=p[ord[i].idx];
+    t2=agora();
+    ok=1;
+    for(size_t i=0;i<nP;i++) if(pq[i].id_produto!=pr[i].id_produto){ ok=0; break; }
+    printf("Produtos (%zu): qsort %.3f s, radix %.3f s + copia %.3f s (%.1fx) %s\n", nP, t1-t0, tr-t1, t2-tr, (t2>t1)? (t1-t0)/(t2-t1) : 0.0, ok? "ordem igual" : "ORDEM DIFERENTE");
+    free(ord); free(p); free(pq); free(pr);
+    return NULL;
+}
+
+static void bench_chaves(int64_t* out, size_t n, const int64_t* v, size_t nv){
+    uint64_t amplitude=(uint64_t)v[nv-1]-(uint64_t)v[0]+1;
+    for(size_t i=0;i<n;i++){
+        uint64_t h=hash_id((int64_t)i);
+        out[i]=(h&1)? v[(h>>1)%nv] : (int64_t)((uint64_t)v[0]+(amplitude? (h>>1)%amplitude : h>>1));
+    }
+}
+
+static size_t idx_disco_buscar(FILE* f, size_t ini, size_t n, int64_t x, int ate){
+    size_t lo=0, hi=n;
+    while(lo<hi){
+        size_t mid=(lo+hi)/2;
+        int64_t chave;
+        if(fseek(f,(long)((ini+mid)*sizeof(PedidosIdxEntry)),SEEK_SET)!=0) die("seek bench");
+        if(fread(&chave,sizeof chave,1,f)!=1) die("read bench");
+        if(ate? chave<=x : chave<x) lo=mid+1; else hi=mid;
+    }
+    return lo;
+}
+
+static const char* cmd_bench_indices(Store* st, const char* s_n){
+    int64_t n64;
+    if(!try_i64(s_n,&n64) || n64<=0){ printf("Quantidade invalida.\n"); return "quantidade inválida"; }
+    size_t n=(size_t)n64;
+    static const char* nomes[3]={"binaria","eytzinger","interpolacao"};
+    int64_t* chaves=malloc(n*sizeof *chaves); if(!chaves) die("malloc bench");
+    for(int tab=0;tab<2;tab++){
+        IndiceMem ix[3];
+        memset(ix,0,sizeof ix);
+        if(tab==0){
+            if(!st->n_jidx){ printf("%s ausente.\n", PATH_JOIAS_IDX); continue; }
+            for(int m=1;m<3;m++) indice_joias_montar(&ix[m],m,st->jidx,st->n_jidx);
+        }else{
+            if(!st->pedidos_idx || !st->n_pidx){ printf("%s ausente.\n", PATH_PEDIDOS_IDX); continue; }
+            for(int m=1;m<3;m++) indice_pedidos_montar(&ix[m],m,st->pedidos_idx,st->pidx_ini,st->n_pidx);
+        }
+        bench_chaves(chaves,n,ix[1].chaves,ix[1].n);
+        double taxa[3]; uint64_t soma[3];
+        for(int m=0;m<3;m++){
+            uint64_t h=0;
+            double t0=agora();
+            for(size_t i=0;i<n;i++){
+                size_t r;
+                if(tab==0) r=(m==0)? jidx_ate(st->jidx,st->n_jidx,chaves[i]) : indice_ate(&ix[m],chaves[i]);
+                else r=(m==0)? pidx_lower_bound(st,chaves[i]) : indice_lower_bound(&ix[m],chaves[i]);
+                h=h*31+r;
+            }
+            double t=agora()-t0;
+            taxa[m]=t>0? (double)n/t/1e6 : 0.0;
+            soma[m]=h;
+        }
+        char path[GER_CAMINHO];
+        FILE* f=fopen(ger_arq(path, tab==0? PATH_JOIAS_IDX : PATH_PEDIDOS_IDX),"rb"); if(!f) die(path);
+        size_t nd=n<BENCH_BUSCAS_DISCO? n : BENCH_BUSCAS_DISCO;
+        size_t* rd=malloc(nd*sizeof *rd); if(!rd) die("malloc bench");
+        double t0=agora();
+        for(size_t i=0;i<nd;i++) rd[i]=idx_disco_buscar(f, tab==0? 0 : st->pidx_ini, ix[1].n, chaves[i], tab==0);
+        double t=agora()-t0;
+        fclose(f);
+        int iguais=(soma[0]==soma[1] && soma[0]==soma[2]);
+        for(size_t i=0;i<nd && iguais;i++)
+            iguais=rd[i]==(tab==0? jidx_ate(st->jidx,st->n_jidx,chaves[i]) : pidx_lower_bound(st,chaves[i]));
+        free(rd);
+        printf("%s (%zu entradas, %zu buscas):", tab==0? PATH_JOIAS_IDX : PATH_PEDIDOS_IDX, ix[1].n, n);
+        printf(" disco %.2f M/s (%zu buscas),", t>0? (double)nd/t/1e6 : 0.0, nd);
+        for(int m=0;m<3;m++) printf(" %s %.2f M/s%s", nomes[m], taxa[m], m<2? ",":"");
+        printf(" %s\n", iguais? "resultados iguais" : "RESULTADOS DIFERENTES");
+        for(int m=1;m<3;m++) indice_liberar(&ix[m]);
+    }
+    free(chaves);
+    return NULL;
+}
+
+static const char* cmd_bench_blocos(Store* st, const char* s_n){
+    int64_t n64;
+    if(!try_i64(s_n,&n64) || n64<=0){ printf("Quantidade invalida.\n"); return "quantidade inválida"; }
+    if(!st->joias && !st->dj.n){ printf("Abra primeiro com import.\n"); return "base ausente (rode import)"; }
+    static const struct { int fmt; uint32_t paginas; } layouts[]={
+        {JOIAS_FMT_COD,0},{JOIAS_FMT_PAG,1},{JOIAS_FMT_PAG,2},{JOIAS_FMT_PAG,4},{JOIAS_FMT_PAG,8},{JOIAS_FMT_PAG,16},{JOIAS_FMT_CMP,0}
+    };
+    size_t n=(size_t)n64, np=0, cap=1024;
+    int64_t* ids=malloc(cap*sizeof *ids); if(!ids) die("malloc bench");
+    IterProd it; iter_prod_abrir(&it,st,&st->dj);
+    const Produto* p;
+    while((p=iter_prod_prox(&it))){
+        if(np==cap){ cap*=2; ids=realloc(ids,cap*sizeof *ids); if(!ids) die("realloc bench"); }
+        ids[np++]=p->id_produto;
+    }
+    iter_prod_fechar(&it);
+    if(!np){ printf("joias.dat vazio.\n"); free(ids); return "joias.dat vazio"; }
+    int64_t* chaves=malloc(n*sizeof *chaves); if(!chaves) die("malloc bench");
+    for(size_t i=0;i<n;i++) chaves[i]=ids[hash_id((int64_t)i)%np];
+    for(size_t c=0;c<sizeof layouts/sizeof layouts[0];c++){
+        LayoutJoias l; joias_layout(&l, layouts[c].fmt, layouts[c].paginas);
+        FILE* f=tmpfile(); if(!f) die("tmpfile bench");
+        Dicionario dic[2]; memset(dic,0,sizeof dic);
+        ProdutoCod ant; memset(&ant,0,sizeof ant);
+        uint64_t soma=FNV_BASE;
+        size_t nb=(np+l.passo-1)/l.passo;
+        int64_t* base=malloc(nb*sizeof *base); uint64_t* off=malloc((nb+1)*sizeof *off);
+        if(!base || !off) die("malloc bench");
+        joias_cabecalho(f,&l,&soma);
+        iter_prod_abrir(&it,st,&st->dj);
+        int r=1;
+        for(uint64_t rec=0; r>0 && (p=iter_prod_prox(&it)); rec++){
+            if(rec%l.passo==0){
+                base[rec/l.passo]=p->id_produto;
+                off[rec/l.passo]=(l.fmt==JOIAS_FMT_CMP? (uint64_t)ftell(f) : joias_offset(&l,rec));
+            }
+            r=joias_escrever(f,&l,rec,dic,p,&ant,&soma);
+        }
+        iter_prod_fechar(&it);
+        dic_liberar(&dic[DIC_CAT]); dic_liberar(&dic[DIC_MARCA]);
+        if(r==JOIAS_DIC_CHEIO){
+            printf("Dicionário de categoria ou marca cheio (%d valores distintos); layouts codificados ignorados.\n", DIC_MAX);
+            free(base); free(off); fclose(f);
+            break;
+        }
+        if(!r) die("w bench");
+        if(fflush(f)!=0) die("w bench");
+        off[nb]=(uint64_t)ftell(f);
+        size_t max=0;
+        for(size_t b=0;b<nb;b++) if(off[b+1]-off[b]>max) max=(size_t)(off[b+1]-off[b]);
+        unsigned char* raw=malloc(max); unsigned char* dec=malloc(l.tam_bloco);
+        if(!raw || !dec) die("malloc bench");
+        double us[2];
+        for(int binaria=0;binaria<2;binaria++){
+            size_t achados=0;
+            double t0=agora();
+            for(size_t i=0;i<n;i++){
+                size_t lo=0, hi=nb;
+                while(lo<hi){ size_t mid=(lo+hi)/2; if(base[mid]<=chaves[i]) lo=mid+1; else hi=mid; }
+                size_t b=lo? lo-1 : 0;
+                ssize_t rd=pread(fileno(f),raw,(size_t)(off[b+1]-off[b]),(off_t)off[b]);
+                const unsigned char* buf=raw;
+                size_t nr=rd>0? (size_t)rd/l.tam : 0, r=0;
+                if(l.fmt==JOIAS_FMT_CMP){ nr=rd>0? joias_cmp_bloco(raw,(size_t)rd,l.passo,dec) : 0; buf=dec; }
+                if(nr>l.passo) nr=l.passo;
+                int64_t id=0;
+                if(binaria){
+                    size_t a=0, z=nr;
+                    while(a<z){ size_t mid=(a+z)/2; memcpy(&id,buf+mid*l.tam,sizeof id); if(id<chaves[i]) a=mid+1; else z=mid; }
+                    r=a;
+                    if(r<nr) memcpy(&id,buf+r*l.tam,sizeof id);
+                }else{
+                    for(; r<nr; r++){ memcpy(&id,buf+r*l.tam,sizeof id); if(id==chaves[i]) break; }
+                }
+                if(r<nr && id==chaves[i]) achados++;
+            }
+            us[binaria]=(agora()-t0)*1e6/(double)n;
+            if(achados!=n) printf("  (apenas %zu de %zu ids encontrados)\n", achados, n);
+        }
+        double total=0, t0=agora();
+        for(int v=0;v<BENCH_VARREDURAS;v++){
+            for(size_t b=0;b<nb;b++){
+                ssize_t rd=pread(fileno(f),raw,(size_t)(off[b+1]-off[b]),(off_t)off[b]);
+                const unsigned char* buf=raw;
+                size_t nr=rd>0? (size_t)rd/l.tam : 0;
+                if(l.fmt==JOIAS_FMT_CMP){ nr=rd>0? joias_cmp_bloco(raw,(size_t)rd,l.passo,dec) : 0; buf=dec; }
+                if(nr>l.passo) nr=l.passo;
+                for(size_t r=0;r<nr;r++){ double preco; memcpy(&preco,buf+r*l.tam+joias_off_preco(l.fmt),sizeof preco); total+=preco; }
+            }
+        }
+        double ms=(agora()-t0)*1e3/BENCH_VARREDURAS;
+        if(l.fmt==JOIAS_FMT_CMP) printf("comprimido  (%6zu bytes, %3zu registros/bloco, %4zu blocos):", (size_t)((off[nb]-off[0])/nb), l.passo, nb);
+        else if(l.fmt==JOIAS_FMT_PAG) printf("%2u paginas  (%6zu bytes, %3zu registros/bloco, %4zu blocos):", l.paginas, l.tam_bloco, l.passo, nb);
+        else printf("sem alinhar (%6zu bytes, %3zu registros/bloco, %4zu blocos):", l.tam_bloco, l.passo, nb);
+        printf(" linear %.3f us, binaria %.3f us por busca; arquivo %llu bytes, varredura %.3f ms (soma %.2f)\n",
+               us[0], us[1], (unsigned long long)off[nb], ms, total/BENCH_VARREDURAS);
+        free(raw); free(dec); free(base); free(off);
+        fclose(f);
+    }
+    free(chaves); free(ids);
+    return NULL;
+}
+
+static const char* cmd_bench_pedidos(Store* st, const char* s_n){
+    int64_t n64;
+    if(!try_i64(s_n,&n64) || n64<=0){ printf("Quantidade invalida.\n"); return "quantidade inválida"; }
+    if(!st->pedidos){ printf("Abra primeiro com import.\n"); return "base ausente (rode import)"; }
+    static const size_t passos[]={1,8,16,32,64,128};
+    size_t n=(size_t)n64, np=0, cap=1024;
+    PedidosIdxEntry* v=malloc(cap*sizeof *v); if(!v) die("malloc bench");
+    CursorPed c; cursor_ped_abrir(&c,st);
+    for(;;){
+        uint64_t off=c.m? (uint64_t)c.pos : (uint64_t)ftell(c.f);
+        const PedidoVar* ped=cursor_ped_prox(&c);
+        if(!ped) break;
+        if(np==cap){ cap*=2; v=realloc(v,cap*sizeof *v); if(!v) die("realloc bench"); }
+        v[np].id_pedido=ped->id_pedido; v[np].offset=off; np++;
+    }
+    cursor_ped_fechar(&c);
+    if(!np){ printf("pedidos.dat vazio.\n"); free(v); return "pedidos.dat vazio"; }
+    int64_t* chaves=malloc(n*sizeof *chaves); if(!chaves) die("malloc bench");
+    for(size_t i=0;i<n;i++) chaves[i]=v[hash_id((int64_t)i)%np].id_pedido;
+    PedidosIdxEntry* cercas=malloc(np*sizeof *cercas); if(!cercas) die("malloc bench");
+    PedidoVar ped; memset(&ped,0,sizeof ped);
+    for(size_t k=0;k<sizeof passos/sizeof passos[0];k++){
+        size_t passo=passos[k], nc=0;
+        for(size_t i=0;i<np;i+=passo) cercas[nc++]=v[i];
+        size_t bytes=(nc+(passo>1))*sizeof(PedidosIdxEntry), achados=0;
+        double t0=agora();
+        for(size_t i=0;i<n;i++){
+            size_t lo=0, hi=nc;
+            while(lo<hi){ size_t mid=(lo+hi)/2; if(cercas[mid].id_pedido<=chaves[i]) lo=mid+1; else hi=mid; }
+            if(lo && pedido_buscar_bloco(st,cercas[lo-1].offset,passo,chaves[i],&ped)) achados++;
+        }
+        double us=(agora()-t0)*1e6/(double)n;
+        printf("%s passo %3zu: %7zu entradas, %9zu bytes, %.3f us por busca\n", passo==1? "denso  " : "esparso", passo, nc, bytes, us);
+        if(achados!=n) printf("  (apenas %zu de %zu ids encontrados)\n", achados, n);
+    }
+    pedvar_free(&ped);
+    free(cercas); free(chaves); free(v);
+    return NULL;
+}
+
+typedef struct { const char* nome; int min_args, max_args; const char* uso; int tabelas; } ComandoCli;
+
+static uint32_t cli_paginas(const char* s){
+    if(strcmp(s,"cmp")==0) return 0;
+    unsigned long v=strtoul(s,NULL,10);
+    return v>=1 && v<=JOIAS_PAGINAS_MAX? (uint32_t)v : UINT32_MAX;
+}
+
+static const ComandoCli comandos_cli[] = {
+    {"import",           0, 3, "import [csv] [paginas_por_bloco|cmp] [passo_pedidos]",   0},
+    {"produto",          1, 1, "produto <id_produto>",                                   USO_JOIAS},
+    {"pedido",           1, 1, "pedido <id_pedido>",                                     USO_PEDIDOS},
+    {"add-produto",      4, 4, "add-produto <categoria> <marca> <nome> <preco>",         USO_JOIAS},
+    {"rm-produto",       1, 1, "rm-produto <id_produto>",                                USO_JOIAS},
+    {"add-pedido",       2, 2, "add-pedido <n_itens> <id,id,...>",                       USO_PEDIDOS},
+    {"rm-pedido",        1, 1, "rm-pedido <id_pedido>",                                  USO_PEDIDOS},
+    {"listar-produtos",  1, 1, "listar-produtos <n>",                                    USO_JOIAS},
+    {"listar-pedidos",   1, 1, "listar-pedidos <n>",                                     USO_PEDIDOS},
+    {"mais-caras",       0, 1, "mais-caras [k]",                                         USO_JOIAS},
+    {"vendas-nome",      1, 1, "vendas-nome <nome>",                                     USO_JOIAS|USO_PEDIDOS},
+    {"vendas-categoria", 1, 1, "vendas-categoria <categoria>",                           USO_JOIAS|USO_PEDIDOS},
+    {"pool",             0, 0, "pool",                                                   0},
+    {"converter",        0, 0, "converter",                                              USO_JOIAS|USO_PEDIDOS},
+    {"compactar",        0, 0, "compactar",                                              USO_JOIAS|USO_PEDIDOS},
+    {"lote",             1, 1, "lote <arquivo>",                                         USO_JOIAS|USO_PEDIDOS},
+    {"bench-ordenacao",  0, 1, "bench-ordenacao [n]",                                    0},
+    {"buscar-indice",    2, 2, "buscar-indice <nome|categoria> <valor>",                 USO_JOIAS},
+    {"verificar-vendas", 0, 0, "verificar-vendas",                                       USO_PEDIDOS},
+    {"faixa-preco",      2, 2, "faixa-preco <min> <max>",                                USO_JOIAS},
+    {"multi-get",        2, 2, "multi-get <produto|pedido> <id,id,...>",                 0},
+    {"bench-indices",    0, 1, "bench-indices [n]",                                      USO_JOIAS|USO_PEDIDOS},
+    {"bench-blocos",     0, 1, "bench-blocos [n]",                                       USO_JOIAS},
+    {"bench-pedidos",    0, 1, "bench-pedidos [n]",                                      USO_PEDIDOS},
+};
+#define N_COMANDOS_CLI (sizeof comandos_cli/sizeof comandos_cli[0])
+
+static const ComandoCli* cli_comando(const char* nome){
+    for(size_t i=0;i<N_COMANDOS_CLI;i++) if(strcmp(comandos_cli[i].nome,nome)==0) return &comandos_cli[i];
+    return NULL;
+}
+
+static const char* const menu_comandos[]={
+    NULL, "import", "produto", "pedido", "add-produto", "rm-produto", "add-pedido", "rm-pedido",
+    "listar-produtos", "listar-pedidos", "mais-caras", "vendas-nome", "vendas-categoria", NULL,
+    "pool", "converter", "compactar", "lote", "bench-ordenacao", "buscar-indice", "verificar-vendas",
+    "faixa-preco", "multi-get", "bench-indices", "bench-blocos", "bench-pedidos", "mais-caras"
+};
+#define N_MENU_COMANDOS (sizeof menu_comandos/sizeof menu_comandos[0])
+
+static void menu_loop(Store* st){
     char buf[512];
     for(;;){
         printf("\n=====================================\n");
@@ -798,28 +4467,44 @@ static void menu_loop(void){
         printf("11) Vendas por nome\n");
         printf("12) Vendas por categoria\n");
         printf("13) Sair\n");
+        printf("14) Estatisticas do buffer pool\n");
+        printf("15) Converter joias.dat e pedidos.dat para formato compacto\n");
+        printf("16) Compactar arquivos delta\n");
+        printf("17) Aplicar lote de operacoes\n");
+        printf("18) Benchmark de ordenacao (qsort x radix)\n");
+        printf("19) Buscar produtos por nome/categoria (indice)\n");
+        printf("20) Verificar agregado de vendas\n");
+        printf("21) Produtos por faixa de preco\n");
+        printf("22) Buscar varios produtos ou pedidos por ID\n");
+        printf("23) Benchmark de busca nos indices\n");
+        printf("24) Benchmark de tamanho de bloco de joias.dat\n");
+        printf("25) Benchmark de pedidos.idx (denso x esparso)\n");
+        printf("26) Joias mais caras (top-K)\n");
         printf("-------------------------------------\n");
         printf("Escolha: "); fflush(stdout);
-        if(!fgets(buf, sizeof(buf), stdin)) { clearerr(stdin); continue; }
+        if(!fgets(buf, sizeof(buf), stdin)) { printf("\nSaindo.\n"); break; }
         int opt = atoi(buf);
+        if(opt != 13) store_atualizar(st);
+        const ComandoCli* cmd = (opt>0 && (size_t)opt<N_MENU_COMANDOS && menu_comandos[opt])? cli_comando(menu_comandos[opt]) : NULL;
+        if(cmd && store_exigir(st, cmd->tabelas)){ press_enter(); continue; }
 
         if(opt == 1){
             char csv[256];
             read_line("Caminho do CSV [default: jewelry.csv]: ", csv, sizeof(csv));
             if(csv[0]=='\0') strcpy(csv, "jewelry.csv");
-            cmd_import(csv);
+            cmd_import(st, csv, JOIAS_PAGINAS_BLOCO, PEDIDOS_IDX_PASSO);
             press_enter();
         } else if(opt == 2){
             char id[64];
             read_line("id_produto: ", id, sizeof(id));
             if(id[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
-            cmd_find_prod(id);
+            cmd_find_prod(st, id);
             press_enter();
         } else if(opt == 3){
             char id[64];
             read_line("id_pedido: ", id, sizeof(id));
             if(id[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
-            cmd_find_pedido(id);
+            cmd_find_pedido(st, id);
             press_enter();
         } else if(opt == 4){
             char cat[128], marca[128], nome[256], preco[64];
@@ -830,13 +4515,13 @@ static void menu_loop(void){
             if(cat[0]=='\0' || nome[0]=='\0' || preco[0]=='\0'){
                 printf("Argumentos invalidos (categoria, nome e preco sao obrigatorios).\n"); press_enter(); continue;
             }
-            cmd_add_produto(cat, marca, nome, preco);
+            cmd_add_produto(st, cat, marca, nome, preco);
             press_enter();
         } else if(opt == 5){
             char id[64];
             read_line("id_produto: ", id, sizeof(id));
             if(id[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
-            cmd_remove_produto(id);
+            cmd_remove_produto(st, id);
             press_enter();
         } else if(opt == 6){
             char n_itens[32], ids_produtos[512];
@@ -845,52 +4530,562 @@ static void menu_loop(void){
             if(n_itens[0]=='\0' || ids_produtos[0]=='\0'){
                 printf("Argumentos invalidos.\n"); press_enter(); continue;
             }
-            cmd_add_pedido(n_itens, ids_produtos);
+            cmd_add_pedido(st, n_itens, ids_produtos);
             press_enter();
         } else if(opt == 7){
             char id[64];
             read_line("id_pedido: ", id, sizeof(id));
             if(id[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
-            cmd_remove_pedido(id);
+            cmd_remove_pedido(st, id);
             press_enter();
         } else if(opt == 8){
             char n[32];
             read_line("Quantos produtos listar? ", n, sizeof(n));
             if(n[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
             long vn = strtol(n, NULL, 10);
-            cmd_list_prod_n(vn);
+            cmd_list_prod_n(st, vn);
             press_enter();
         } else if(opt == 9){
             char n[32];
             read_line("Quantos pedidos listar? ", n, sizeof(n));
             if(n[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
             long vn = strtol(n, NULL, 10);
-            cmd_list_pedidos_n(vn);
+            cmd_list_pedidos_n(st, vn);
             press_enter();
         } else if(opt == 10){
-            q_joia_mais_cara();
+            q_joias_mais_caras(st, "1");
             press_enter();
         } else if(opt == 11){
             char nome[256];
             read_line("Nome exato da joia (ex: \"earring red gold diamond\"): ", nome, sizeof(nome));
             if(nome[0]=='\0'){ printf("Nome vazio.\n"); press_enter(); continue; }
-            q_vendas_por_nome(nome);
+            q_vendas_por_nome(st, nome);
             press_enter();
         } else if(opt == 12){
             char cat[64];
             read_line("Categoria (ex: earring | pendant | necklace ...): ", cat, sizeof(cat));
             if(cat[0]=='\0'){ printf("Categoria vazia.\n"); press_enter(); continue; }
-            q_vendas_por_categoria(cat);
+            q_vendas_por_categoria(st, cat);
             press_enter();
         } else if(opt == 13){
             printf("Saindo.\n"); break;
+        } else if(opt == 14){
+            cmd_stats_pool(st);
+            press_enter();
+        } else if(opt == 15){
+            cmd_converter_joias(st);
+            cmd_converter_pedidos(st);
+            press_enter();
+        } else if(opt == 16){
+            cmd_compactar(st);
+            press_enter();
+        } else if(opt == 17){
+            char arq[256];
+            read_line("Arquivo de operacoes: ", arq, sizeof(arq));
+            if(arq[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
+            ResumoLote r;
+            cmd_lote(st, arq, &r);
+            press_enter();
+        } else if(opt == 18){
+            char n[32];
+            read_line("Quantidade de linhas [default: 2000000]: ", n, sizeof(n));
+            if(n[0]=='\0') strcpy(n, "2000000");
+            cmd_bench_ordenacao(n);
+            press_enter();
+        } else if(opt == 19){
+            char campo[32], termo[256];
+            read_line("Campo (nome | categoria): ", campo, sizeof(campo));
+            read_line("Valor: ", termo, sizeof(termo));
+            if(campo[0]=='\0' || termo[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
+            cmd_buscar_indice(st, campo, termo);
+            press_enter();
+        } else if(opt == 20){
+            ResumoVendas r;
+            cmd_verificar_vendas(st, &r);
+            press_enter();
+        } else if(opt == 21){
+            char pmin[64], pmax[64];
+            read_line("Preco minimo: ", pmin, sizeof(pmin));
+            read_line("Preco maximo: ", pmax, sizeof(pmax));
+            if(pmin[0]=='\0' || pmax[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
+            q_joias_faixa_preco(st, pmin, pmax);
+            press_enter();
+        } else if(opt == 22){
+            char tabela[32], ids[8192];
+            read_line("Tabela (produto | pedido): ", tabela, sizeof(tabela));
+            read_line("IDs (separados por virgula ou espaco): ", ids, sizeof(ids));
+            if(tabela[0]=='\0' || ids[0]=='\0'){ printf("Valor invalido.\n"); press_enter(); continue; }
+            cmd_multiget(st, tabela, ids);
+            press_enter();
+        } else if(opt == 23){
+            char n[32];
+            read_line("Quantidade de buscas [default: 1000000]: ", n, sizeof(n));
+            if(n[0]=='\0') strcpy(n, "1000000");
+            cmd_bench_indices(st, n);
+            press_enter();
+        } else if(opt == 24){
+            char n[32];
+            read_line("Quantidade de buscas [default: 200000]: ", n, sizeof(n));
+            if(n[0]=='\0') strcpy(n, "200000");
+            cmd_bench_blocos(st, n);
+            press_enter();
+        } else if(opt == 25){
+            char n[32];
+            read_line("Quantidade de buscas [default: 200000]: ", n, sizeof(n));
+            if(n[0]=='\0') strcpy(n, "200000");
+            cmd_bench_pedidos(st, n);
+            press_enter();
+        } else if(opt == 26){
+            char k[32];
+            read_line("Quantas joias? [default: 1]: ", k, sizeof(k));
+            if(k[0]=='\0') strcpy(k, "1");
+            q_joias_mais_caras(st, k);
+            press_enter();
         } else {
             printf("Opcao invalida.\n");
         }
     }
 }
 
-int main(){
-    menu_loop();
-    return 0;
+static int indice_modo(void){
+    int64_t v=config_env("INDICE_MEM",INDICE_MEM,0);
+    if(v>INDICE_INTERPOLACAO){
+        fprintf(stderr,"INDICE_MEM inválido: \"%lld\" (usando %d).\n", (long long)v, INDICE_MEM);
+        return INDICE_MEM;
+    }
+    return (int)v;
+}
+
+static void cli_uso(FILE* f){
+    fprintf(f,"uso: trabalho                      (menu interativo)\n");
+    fprintf(f,"     trabalho <comando> [args]\n");
+    fprintf(f,"     trabalho script [arquivo|-] [--tsv|--json]\n");
+    fprintf(f,"comandos:\n");
+    for(size_t i=0;i<N_COMANDOS_CLI;i++) fprintf(f,"  %s\n", comandos_cli[i].uso);
+}
+
+static const char* cli_texto(Store* st, int argc, char** argv){
+    const char* c=argv[0];
+    if(strcmp(c,"import")==0) return cmd_import(st, argc>1? argv[1] : "jewelry.csv", argc>2? cli_paginas(argv[2]) : JOIAS_PAGINAS_BLOCO,
+                                         argc>3? (size_t)strtoul(argv[3],NULL,10) : PEDIDOS_IDX_PASSO);
+    else if(strcmp(c,"produto")==0) return cmd_find_prod(st, argv[1]);
+    else if(strcmp(c,"pedido")==0) return cmd_find_pedido(st, argv[1]);
+    else if(strcmp(c,"add-produto")==0) return cmd_add_produto(st, argv[1], argv[2], argv[3], argv[4]);
+    else if(strcmp(c,"rm-produto")==0) return cmd_remove_produto(st, argv[1]);
+    else if(strcmp(c,"add-pedido")==0) return cmd_add_pedido(st, argv[1], argv[2]);
+    else if(strcmp(c,"rm-pedido")==0) return cmd_remove_pedido(st, argv[1]);
+    else if(strcmp(c,"listar-produtos")==0) return cmd_list_prod_n(st, strtol(argv[1],NULL,10));
+    else if(strcmp(c,"listar-pedidos")==0) return cmd_list_pedidos_n(st, strtol(argv[1],NULL,10));
+    else if(strcmp(c,"mais-caras")==0) return q_joias_mais_caras(st, argc>1? argv[1] : "1");
+    else if(strcmp(c,"vendas-nome")==0) return q_vendas_por_nome(st, argv[1]);
+    else if(strcmp(c,"vendas-categoria")==0) return q_vendas_por_categoria(st, argv[1]);
+    else if(strcmp(c,"pool")==0) cmd_stats_pool(st);
+    else if(strcmp(c,"converter")==0){
+        int j=cmd_converter_joias(st), p=cmd_converter_pedidos(st);
+        if(j==CONV_AUSENTE && p==CONV_AUSENTE) return "joias.dat e pedidos.dat ausentes";
+    }
+    else if(strcmp(c,"compactar")==0) return cmd_compactar(st);
+    else if(strcmp(c,"lote")==0){ ResumoLote r; return cmd_lote(st, argv[1], &r); }
+    else if(strcmp(c,"bench-ordenacao")==0) return cmd_bench_ordenacao(argc>1? argv[1] : "2000000");
+    else if(strcmp(c,"buscar-indice")==0) return cmd_buscar_indice(st, argv[1], argv[2]);
+    else if(strcmp(c,"verificar-vendas")==0){ ResumoVendas r; return cmd_verificar_vendas(st, &r); }
+    else if(strcmp(c,"faixa-preco")==0) return q_joias_faixa_preco(st, argv[1], argv[2]);
+    else if(strcmp(c,"multi-get")==0) return cmd_multiget(st, argv[1], argv[2]);
+    else if(strcmp(c,"bench-indices")==0) return cmd_bench_indices(st, argc>1? argv[1] : "1000000");
+    else if(strcmp(c,"bench-blocos")==0) return cmd_bench_blocos(st, argc>1? argv[1] : "200000");
+    else if(strcmp(c,"bench-pedidos")==0) return cmd_bench_pedidos(st, argc>1? argv[1] : "200000");
+    return NULL;
+}
+
+typedef struct { FILE* f; int json, lista; size_t campos, itens, falhas; } Saida;
+
+static void saida_texto(Saida* o, const char* s, size_t max){
+    for(size_t i=0;i<max && s[i];i++){
+        unsigned char c=(unsigned char)s[i];
+        if(c=='\\') fputs("\\\\",o->f);
+        else if(c=='\t') fputs("\\t",o->f);
+        else if(c=='\n') fputs("\\n",o->f);
+        else if(c=='\r') fputs("\\r",o->f);
+        else if(o->json && c=='"') fputs("\\\"",o->f);
+        else if(o->json && c<0x20) fprintf(o->f,"\\u%04x",c);
+        else fputc(c,o->f);
+    }
+}
+static void saida_campo(Saida* o, const char* nome){
+    if(o->json) fprintf(o->f,"%s\"%s\":", o->campos? ",":"", nome);
+    else if(o->campos) fputc('\t',o->f);
+    o->campos++;
+}
+static void saida_str(Saida* o, const char* nome, const char* v, size_t max){
+    saida_campo(o,nome);
+    if(o->json) fputc('"',o->f);
+    saida_texto(o,v,max);
+    if(o->json) fputc('"',o->f);
+}
+static void saida_i64(Saida* o, const char* nome, long long v){ saida_campo(o,nome); fprintf(o->f,"%lld",v); }
+static void saida_f64(Saida* o, const char* nome, double v){
+    char b[32];
+    if(o->json && !isfinite(v)) strcpy(b,"null");
+    else{
+        snprintf(b,sizeof b,"%.15g",v);
+        if(strtod(b,NULL)!=v) snprintf(b,sizeof b,"%.17g",v);
+    }
+    saida_campo(o,nome); fputs(b,o->f);
+}
+static void saida_ids(Saida* o, const char* nome, const int64_t* v, size_t n){
+    saida_campo(o,nome);
+    if(o->json) fputc('[',o->f);
+    for(size_t i=0;i<n;i++) fprintf(o->f,"%s%lld", i? ",":"", (long long)v[i]);
+    if(o->json) fputc(']',o->f);
+}
+static void saida_inicio(Saida* o, const char* cmd, int ok){
+    o->campos=1; o->lista=0;
+    if(!ok) o->falhas++;
+    if(o->json) fprintf(o->f,"{\"ok\":%s", ok? "true":"false");
+    else fputs(ok? "ok":"erro", o->f);
+    saida_str(o,"cmd",cmd,SIZE_MAX);
+}
+static void saida_lista(Saida* o, const char* nome, size_t n){
+    if(o->json){ saida_campo(o,nome); fputc('[',o->f); }
+    else{ saida_i64(o,nome,(long long)n); fputc('\n',o->f); }
+    o->lista=1; o->itens=0;
+}
+static void saida_item(Saida* o){
+    if(o->json) fputs(o->itens? ",{" : "{", o->f);
+    o->itens++; o->campos=0;
+}
+static void saida_item_fim(Saida* o){ fputc(o->json? '}' : '\n', o->f); }
+static void saida_fim(Saida* o){
+    if(o->json) fputs(o->lista? "]}\n" : "}\n", o->f);
+    else if(!o->lista) fputc('\n',o->f);
+}
+static void saida_erro(Saida* o, const char* cmd, const char* msg){
+    saida_inicio(o,cmd,0);
+    saida_str(o,"erro",msg,SIZE_MAX);
+    saida_fim(o);
+}
+static void saida_produto(Saida* o, const Produto* p){
+    saida_i64(o,"id_produto",(long long)p->id_produto);
+    saida_str(o,"categoria",p->categoria,CAT_MAX);
+    saida_str(o,"marca",p->marca,MARCA_MAX);
+    saida_str(o,"nome",p->nome,NOME_MAX);
+    saida_f64(o,"preco",p->preco);
+}
+static void saida_produtos(Saida* o, const Produto* v, size_t n){
+    saida_lista(o,"produtos",n);
+    for(size_t i=0;i<n;i++){ saida_item(o); saida_produto(o,&v[i]); saida_item_fim(o); }
+}
+
+static int cli_dados(Store* st, Saida* o, int argc, char** argv){
+    const char* c=argv[0];
+    int64_t id;
+    if(strcmp(c,"produto")==0){
+        Produto p;
+        if(!try_i64(argv[1],&id)){ saida_erro(o,c,"id_produto inválido"); return 1; }
+        if(!buscar_produto_por_id(st,id,&p)){ saida_erro(o,c,"produto não encontrado"); return 1; }
+        saida_inicio(o,c,1); saida_produto(o,&p); saida_fim(o);
+    }else if(strcmp(c,"pedido")==0){
+        PedidoVar ped; memset(&ped,0,sizeof ped);
+        if(!try_i64(argv[1],&id)){ saida_erro(o,c,"id_pedido inválido"); return 1; }
+        if(!buscar_pedido(st,id,&ped)){ pedvar_free(&ped); saida_erro(o,c,"pedido não encontrado"); return 1; }
+        saida_inicio(o,c,1);
+        saida_i64(o,"id_pedido",(long long)ped.id_pedido);
+        saida_lista(o,"itens",(size_t)ped.n_itens);
+        for(int32_t i=0;i<ped.n_itens;i++){ saida_item(o); saida_i64(o,"id_produto",(long long)ped.ids_produtos[i]); saida_item_fim(o); }
+        saida_fim(o);
+        pedvar_free(&ped);
+    }else if(strcmp(c,"add-produto")==0){
+        double preco;
+        if(!try_f64(argv[4],&preco) || !isfinite(preco)){ saida_erro(o,c,"preco inválido"); return 1; }
+        if(!argv[1][0] || !argv[3][0]){ saida_erro(o,c,"categoria e nome são obrigatórios"); return 1; }
+        id=produto_inserir(st,argv[1],argv[2],argv[3],preco);
+            saida_inicio(o,c,1); saida_i64(o,"id_produto",(long long)id); saida_fim(o);
+    }else if(strcmp(c,"rm-produto")==0){
+        if(!try_i64(argv[1],&id)){ saida_erro(o,c,"id_produto inválido"); return 1; }
+        if(!produto_remover(st,id)){ saida_erro(o,c,"produto não encontrado"); return 1; }
+            saida_inicio(o,c,1); saida_i64(o,"id_produto",(long long)id); saida_fim(o);
+    }else if(strcmp(c,"add-pedido")==0){
+        int64_t* ids;
+        int32_t n=ler_itens_pedido(st,argv[1],argv[2],&ids);
+        if(n<0){ saida_erro(o,c,"itens inválidos"); return 1; }
+        id=pedido_inserir(st,n,ids);
+        free(ids);
+            saida_inicio(o,c,1); saida_i64(o,"id_pedido",(long long)id); saida_i64(o,"n_itens",n); saida_fim(o);
+    }else if(strcmp(c,"rm-pedido")==0){
+        if(!try_i64(argv[1],&id)){ saida_erro(o,c,"id_pedido inválido"); return 1; }
+        if(!pedido_remover(st,id)){ saida_erro(o,c,"pedido não encontrado"); return 1; }
+            saida_inicio(o,c,1); saida_i64(o,"id_pedido",(long long)id); saida_fim(o);
+    }else if(strcmp(c,"vendas-nome")==0 || strcmp(c,"vendas-categoria")==0){
+        if(!argv[1][0]){ saida_erro(o,c,strcmp(c,"vendas-nome")==0? "nome vazio" : "categoria vazia"); return 1; }
+        long long u=contar_vendas(st, strcmp(c,"vendas-nome")==0? SEC_NOME : SEC_CAT, argv[1]);
+        if(u<0){ saida_erro(o,c,"pedidos.dat ausente"); return 1; }
+        saida_inicio(o,c,1); saida_i64(o,"unidades",u); saida_fim(o);
+    }else if(strcmp(c,"mais-caras")==0){
+        long k=argc>1? strtol(argv[1],NULL,10) : 1;
+        if(k<=0 || k>TOPK_MAX){ saida_erro(o,c,"k inválido"); return 1; }
+        if(!st->joias && !st->dj.n){ saida_erro(o,c,"joias.dat ausente"); return 1; }
+        Produto h[TOPK_MAX];
+        size_t lidos, n=joias_topk(st,(size_t)k,h,&lidos);
+        saida_inicio(o,c,1);
+        saida_i64(o,"blocos_lidos",(long long)lidos); saida_i64(o,"blocos",(long long)st->zonas.n);
+        saida_produtos(o,h,n);
+        saida_fim(o);
+    }else if(strcmp(c,"faixa-preco")==0){
+        double lo, hi;
+        if(!try_f64(argv[1],&lo) || !try_f64(argv[2],&hi) || !isfinite(lo) || !isfinite(hi) || lo>hi){ saida_erro(o,c,"faixa de preço inválida"); return 1; }
+        if(!st->joias && !st->dj.n){ saida_erro(o,c,"joias.dat ausente"); return 1; }
+        Produto lista[SEC_LISTA_MAX];
+        size_t nl, lidos, n=joias_faixa(st,lo,hi,lista,&nl,&lidos);
+        saida_inicio(o,c,1);
+        saida_i64(o,"total",(long long)n);
+        saida_i64(o,"blocos_lidos",(long long)lidos); saida_i64(o,"blocos",(long long)st->zonas.n);
+        saida_produtos(o,lista,nl);
+        saida_fim(o);
+    }else if(strcmp(c,"buscar-indice")==0){
+        int campo=sec_campo(argv[1]);
+        if(campo<0){ saida_erro(o,c,"campo inválido (use nome ou categoria)"); return 1; }
+        if(!st->joias && !st->dj.n){ saida_erro(o,c,"joias.dat ausente"); return 1; }
+        size_t n, nl=0;
+        int64_t* ids=sec_consultar(st,campo,argv[2],&n);
+        Produto lista[SEC_LISTA_MAX];
+        for(size_t i=0;i<n && nl<SEC_LISTA_MAX;i++) if(buscar_produto_por_id(st,ids[i],&lista[nl])) nl++;
+        free(ids);
+        saida_inicio(o,c,1);
+        saida_i64(o,"total",(long long)n);
+        saida_produtos(o,lista,nl);
+        saida_fim(o);
+    }else if(strcmp(c,"multi-get")==0){
+        int pedidos=equals_ignore_case(argv[1],"pedido");
+        if(!pedidos && !equals_ignore_case(argv[1],"produto")){ saida_erro(o,c,"tabela inválida (use produto ou pedido)"); return 1; }
+        if(store_exigir(st,pedidos? USO_PEDIDOS : USO_JOIAS)){ saida_erro(o,c,st->erro); return 1; }
+        int64_t* ids;
+        int32_t n=ler_ids(argv[2],&ids);
+        if(n<=0){ saida_erro(o,c,"lista de IDs inválida"); return 1; }
+        unsigned char* achado=malloc((size_t)n); if(!achado) die("malloc multiget");
+        if(!pedidos){
+            Produto* v=malloc((size_t)n*sizeof *v); if(!v) die("malloc multiget");
+            size_t lidos, k=multiget_produtos(st,ids,(size_t)n,v,achado,&lidos);
+            saida_inicio(o,c,1);
+            saida_i64(o,"encontrados",(long long)k); saida_i64(o,"blocos_lidos",(long long)lidos);
+            saida_lista(o,"produtos",(size_t)n);
+            for(int32_t i=0;i<n;i++){
+                saida_item(o);
+                saida_i64(o,"achado",achado[i]);
+                if(achado[i]) saida_produto(o,&v[i]); else saida_i64(o,"id_produto",(long long)ids[i]);
+                saida_item_fim(o);
+            }
+            free(v);
+        }else{
+            PedidoVar* v=calloc((size_t)n,sizeof *v); if(!v) die("malloc multiget");
+            size_t k=multiget_pedidos(st,ids,(size_t)n,v,achado);
+            saida_inicio(o,c,1);
+            saida_i64(o,"encontrados",(long long)k);
+            saida_lista(o,"pedidos",(size_t)n);
+            for(int32_t i=0;i<n;i++){
+                saida_item(o);
+                saida_i64(o,"achado",achado[i]);
+                saida_i64(o,"id_pedido",(long long)ids[i]);
+                if(achado[i]) saida_ids(o,"ids_produtos",v[i].ids_produtos,(size_t)v[i].n_itens);
+                saida_item_fim(o);
+                pedvar_free(&v[i]);
+            }
+            free(v);
+        }
+        saida_fim(o);
+        free(achado); free(ids);
+    }else if(strcmp(c,"listar-produtos")==0){
+        long n=strtol(argv[1],NULL,10);
+        if(n<=0){ saida_erro(o,c,"n inválido"); return 1; }
+        if(!st->joias && !st->dj.n){ saida_erro(o,c,"joias.dat ausente"); return 1; }
+        size_t k=0, cap=(size_t)(n<SEC_LISTA_MAX? n : SEC_LISTA_MAX);
+        Produto* v=malloc(cap*sizeof *v); if(!v) die("malloc listar");
+        IterProd it; iter_prod_abrir(&it, st, &st->dj);
+        const Produto* p;
+        while(k<(size_t)n && (p=iter_prod_prox(&it))){
+            if(k==cap && !(v=realloc(v,(cap*=2)*sizeof *v))) die("realloc listar");
+            v[k++]=*p;
+        }
+        iter_prod_fechar(&it);
+        saida_inicio(o,c,1); saida_produtos(o,v,k); saida_fim(o);
+        free(v);
+    }else if(strcmp(c,"listar-pedidos")==0){
+        long n=strtol(argv[1],NULL,10);
+        if(n<=0){ saida_erro(o,c,"n inválido"); return 1; }
+        if(!st->pedidos && !st->dp.n){ saida_erro(o,c,"pedidos.dat ausente"); return 1; }
+        size_t k=0, cap=(size_t)(n<SEC_LISTA_MAX? n : SEC_LISTA_MAX);
+        int64_t* ids=malloc(cap*sizeof *ids); int32_t* itens=malloc(cap*sizeof *itens);
+        if(!ids || !itens) die("malloc listar");
+        IterPed it; iter_ped_abrir(&it, st, &st->dp);
+        const PedidoVar* ped;
+        while(k<(size_t)n && (ped=iter_ped_prox(&it))){
+            if(k==cap){
+                cap*=2;
+                if(!(ids=realloc(ids,cap*sizeof *ids)) || !(itens=realloc(itens,cap*sizeof *itens))) die("realloc listar");
+            }
+            ids[k]=ped->id_pedido; itens[k++]=ped->n_itens;
+        }
+        iter_ped_fechar(&it);
+        saida_inicio(o,c,1);
+        saida_lista(o,"pedidos",k);
+        for(size_t i=0;i<k;i++){ saida_item(o); saida_i64(o,"id_pedido",(long long)ids[i]); saida_i64(o,"n_itens",itens[i]); saida_item_fim(o); }
+        saida_fim(o);
+        free(ids); free(itens);
+    }else if(strcmp(c,"pool")==0){
+        BufPool* bp=&st->pool;
+        saida_inicio(o,c,1);
+        saida_str(o,"leitura",st->usar_mmap? "mmap" : "pool",SIZE_MAX);
+        saida_i64(o,"quadros",(long long)bp->nquadros);
+        saida_i64(o,"bytes",(long long)bp->bytes); saida_i64(o,"cap_bytes",(long long)bp->cap_bytes);
+        saida_i64(o,"hits",(long long)bp->hits); saida_i64(o,"misses",(long long)bp->misses);
+        saida_i64(o,"diretos",(long long)bp->diretos);
+        saida_i64(o,"geracao",(long long)st->ger);
+        saida_fim(o);
+    }else if(strcmp(c,"import")==0){
+        const char* erro=cli_texto(st,argc,argv);
+        fflush(stdout);
+        if(erro){ saida_erro(o,c,erro); return 1; }
+        saida_inicio(o,c,1);
+        saida_i64(o,"produtos",(long long)st->meta_joias.n_registros);
+        saida_i64(o,"pedidos",(long long)st->meta_pedidos.n_registros);
+        saida_i64(o,"geracao",(long long)st->ger);
+        saida_fim(o);
+    }else if(strcmp(c,"converter")==0){
+        static const char* const estados[]={"ausente","mantido","convertido"};
+        int j=cmd_converter_joias(st), p=cmd_converter_pedidos(st);
+        fflush(stdout);
+        if(j==CONV_AUSENTE && p==CONV_AUSENTE){ saida_erro(o,c,"joias.dat e pedidos.dat ausentes"); return 1; }
+        saida_inicio(o,c,1);
+        saida_str(o,"joias",estados[j],SIZE_MAX); saida_str(o,"pedidos",estados[p],SIZE_MAX);
+        saida_i64(o,"geracao",(long long)st->ger);
+        saida_fim(o);
+    }else if(strcmp(c,"compactar")==0){
+        store_escritor(st);
+        size_t nj=st->dj.nlog, np=st->dp.nlog;
+        const char* erro=cmd_compactar(st);
+        store_soltar_escritor(st);
+        fflush(stdout);
+        if(erro){ saida_erro(o,c,erro); return 1; }
+        saida_inicio(o,c,1);
+        saida_i64(o,"ops_joias",(long long)nj); saida_i64(o,"ops_pedidos",(long long)np);
+        saida_i64(o,"geracao",(long long)st->ger);
+        saida_fim(o);
+    }else if(strcmp(c,"lote")==0){
+        ResumoLote r; memset(&r,0,sizeof r);
+        const char* erro=cmd_lote(st,argv[1],&r);
+        fflush(stdout);
+        if(erro && !r.ausentes && !r.invalidas){ saida_erro(o,c,erro); return 1; }
+        saida_inicio(o,c,!erro);
+        if(erro) saida_str(o,"erro",erro,SIZE_MAX);
+        saida_i64(o,"aplicadas",(long long)r.aplicadas); saida_i64(o,"ausentes",(long long)r.ausentes);
+        saida_i64(o,"invalidas",(long long)r.invalidas);
+        saida_fim(o);
+    }else if(strcmp(c,"verificar-vendas")==0){
+        ResumoVendas r;
+        const char* erro=cmd_verificar_vendas(st,&r);
+        fflush(stdout);
+        if(erro){ saida_erro(o,c,erro); return 1; }
+        saida_inicio(o,c,1);
+        saida_str(o,"estado",r.regravado? "regravado" : "ok",SIZE_MAX);
+        saida_i64(o,"produtos",(long long)r.produtos); saida_i64(o,"unidades",r.unidades);
+        saida_i64(o,"divergentes",(long long)r.divergentes);
+        saida_fim(o);
+    }else return 0;
+    return 1;
+}
+
+static int cli_separar(char* linha, char** argv, int max){
+    int n=0;
+    rstrip2(linha);
+    if(strchr(linha,'\t')){
+        for(char* t=linha; t && n<max; ){
+            argv[n++]=t;
+            if((t=strchr(t,'\t'))) *t++='\0';
+        }
+        return n;
+    }
+    size_t len=strlen(linha);
+    while(len>0 && linha[len-1]==' ') linha[--len]='\0';
+    for(char* t=linha; n<max; ){
+        while(*t==' ') t++;
+        if(!*t) break;
+        const ComandoCli* c=(n? cli_comando(argv[0]) : NULL);
+        if(c && n==c->max_args && *t!='"'){ argv[n++]=t; break; }
+        if(*t=='"'){
+            char* w=++t;
+            argv[n++]=w;
+            while(*t && (*t!='"' || t[1]=='"')){ if(*t=='"') t++; *w++=*t++; }
+            if(!*t){ *w='\0'; break; }
+            *w='\0'; t++;
+            continue;
+        }else{
+            argv[n++]=t;
+            t+=strcspn(t," ");
+            if(!*t) break;
+        }
+        *t++='\0';
+    }
+    return n;
+}
+
+static int cli_script(int argc, char** argv){
+    const char* arq=NULL;
+    int json=0;
+    for(int i=0;i<argc;i++){
+        if(strcmp(argv[i],"--json")==0) json=1;
+        else if(strcmp(argv[i],"--tsv")==0) json=0;
+        else if(!arq) arq=argv[i];
+        else{ cli_uso(stderr); return 2; }
+    }
+    FILE* in=stdin;
+    if(arq && strcmp(arq,"-")!=0 && !(in=fopen(arq,"r"))){ perror(arq); return 1; }
+    fflush(stdout);
+    int fd=dup(STDOUT_FILENO);
+    if(fd<0 || dup2(STDERR_FILENO,STDOUT_FILENO)<0) die("dup stdout");
+    Saida o; memset(&o,0,sizeof o);
+    o.json=json;
+    if(!(o.f=fdopen(fd,"w"))) die("fdopen stdout");
+    Store st;
+    store_abrir(&st, POOL_BYTES, USAR_MMAP, indice_modo());
+    char* linha=NULL; size_t cap=0;
+    char* args[CLI_ARGS_MAX];
+    while(getline(&linha,&cap,in)>=0){
+        int n=cli_separar(linha,args,CLI_ARGS_MAX);
+        if(n==0 || args[0][0]=='#') continue;
+        store_atualizar(&st);
+        const ComandoCli* c=cli_comando(args[0]);
+        if(!c) saida_erro(&o,args[0],"comando desconhecido");
+        else if(n-1<c->min_args || n-1>c->max_args) saida_erro(&o,args[0],c->uso);
+        else if(store_exigir(&st,c->tabelas)) saida_erro(&o,args[0],st.erro);
+        else if(!cli_dados(&st,&o,n,args)){
+            const char* erro=cli_texto(&st,n,args);
+            fflush(stdout);
+            if(erro) saida_erro(&o,args[0],erro);
+            else{ saida_inicio(&o,args[0],1); saida_fim(&o); }
+        }
+        if(in==stdin) fflush(o.f);
+    }
+    free(linha);
+    if(in!=stdin) fclose(in);
+    store_fechar(&st);
+    fclose(o.f);
+    return o.falhas? 1 : 0;
+}
+
+int main(int argc, char** argv){
+    Store st;
+    if(argc<2){
+        store_abrir(&st, POOL_BYTES, USAR_MMAP, indice_modo());
+        if(st.indisponivel) printf("%s.\n", st.erro);
+        menu_loop(&st);
+        store_fechar(&st);
+        return 0;
+    }
+    if(strcmp(argv[1],"script")==0) return cli_script(argc-2, argv+2);
+    const ComandoCli* c=cli_comando(argv[1]);
+    if(!c || argc-2<c->min_args || argc-2>c->max_args){ cli_uso(stderr); return 2; }
+    store_abrir(&st, POOL_BYTES, USAR_MMAP, indice_modo());
+    const char* erro=store_exigir(&st, c->tabelas);
+    if(!erro) erro=cli_texto(&st, argc-1, argv+1);
+    store_fechar(&st);
+    return erro? 1 : 0;
 }